@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "BenchmarkRunner.h"
+
+#include <QDateTime>
+#include <QVector>
+
+#include <algorithm>
+#include <cmath>
+
+using Clock = std::chrono::steady_clock;
+
+// A batch has to be long enough for the clock resolution to not matter.
+static const std::chrono::microseconds s_minBatchDuration(100);
+static const int s_maxBatchSize = 1 << 20;
+static const int s_minSampleCount = 10;
+static const int s_maxSampleCount = 10000;
+
+static std::chrono::nanoseconds runBatch(const std::function<void()>& body, int batchSize)
+{
+    const Clock::time_point start = Clock::now();
+    for (int i = 0; i < batchSize; ++i)
+        body();
+    return Clock::now() - start;
+}
+
+static double percentile(const QVector<double>& sorted, double fraction)
+{
+    const int index = qBound(0, int(std::ceil(fraction * sorted.count())) - 1, sorted.count() - 1);
+    return sorted.at(index);
+}
+
+BenchmarkRunner::BenchmarkRunner()
+    : m_timeBudget(1000)
+{
+}
+
+void BenchmarkRunner::setFilter(const QRegularExpression& filter)
+{
+    m_filter = filter;
+}
+
+bool BenchmarkRunner::isSelected(const QString& name) const
+{
+    return m_filter.pattern().isEmpty() || m_filter.match(name).hasMatch();
+}
+
+std::chrono::milliseconds BenchmarkRunner::timeBudget() const
+{
+    return m_timeBudget;
+}
+
+void BenchmarkRunner::setTimeBudget(const std::chrono::milliseconds& budget)
+{
+    m_timeBudget = budget;
+}
+
+void BenchmarkRunner::measure(const QString& name, std::function<void()> body)
+{
+    if (!isSelected(name))
+        return;
+
+    // Doubling the batch size also warms up caches and lazily built state.
+    int batchSize = 1;
+    while (runBatch(body, batchSize) < s_minBatchDuration && batchSize < s_maxBatchSize)
+        batchSize *= 2;
+
+    QVector<double> samples;
+    const Clock::time_point deadline = Clock::now() + m_timeBudget;
+
+    while (samples.count() < s_maxSampleCount) {
+        if (samples.count() >= s_minSampleCount && Clock::now() >= deadline)
+            break;
+        const std::chrono::nanoseconds elapsed = runBatch(body, batchSize);
+        samples << double(elapsed.count()) / batchSize;
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0;
+    for (double sample : samples)
+        sum += sample;
+    const double mean = sum / samples.count();
+
+    double squares = 0;
+    for (double sample : samples)
+        squares += (sample - mean) * (sample - mean);
+
+    QJsonObject nanoseconds;
+    nanoseconds[QStringLiteral("min")] = samples.first();
+    nanoseconds[QStringLiteral("median")] = percentile(samples, 0.5);
+    nanoseconds[QStringLiteral("mean")] = mean;
+    nanoseconds[QStringLiteral("p95")] = percentile(samples, 0.95);
+    nanoseconds[QStringLiteral("max")] = samples.last();
+    nanoseconds[QStringLiteral("stddev")] = std::sqrt(squares / samples.count());
+
+    QJsonObject result;
+    result[QStringLiteral("name")] = name;
+    result[QStringLiteral("kind")] = QStringLiteral("time");
+    result[QStringLiteral("batchSize")] = batchSize;
+    result[QStringLiteral("samples")] = samples.count();
+    result[QStringLiteral("nanosecondsPerIteration")] = nanoseconds;
+
+    m_results.append(result);
+}
+
+void BenchmarkRunner::record(const QString& name, const QJsonObject& metrics)
+{
+    if (!isSelected(name))
+        return;
+
+    QJsonObject result;
+    result[QStringLiteral("name")] = name;
+    result[QStringLiteral("kind")] = QStringLiteral("metrics");
+    result[QStringLiteral("metrics")] = metrics;
+
+    m_results.append(result);
+}
+
+QJsonObject BenchmarkRunner::report() const
+{
+    QJsonObject report;
+    report[QStringLiteral("version")] = 1;
+    report[QStringLiteral("date")] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report[QStringLiteral("benchmarks")] = m_results;
+
+    return report;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QString>
+
+#include <chrono>
+#include <functional>
+
+/**
+ * Runs benchmarks and collects their results.
+ *
+ * A measured benchmark is run in batches until its time budget is used up,
+ * and the time per iteration of every batch makes one sample. Benchmarks that
+ * measure themselves, e.g. throughput over a period of time, only hand in
+ * their metrics. All results are reported as a single JSON document.
+ */
+class BenchmarkRunner {
+public:
+    BenchmarkRunner();
+
+    /**
+     * Only benchmarks whose name matches the @p filter are run.
+     */
+    void setFilter(const QRegularExpression& filter);
+
+    /**
+     * Returns whether the benchmark with the given @p name should be run.
+     */
+    bool isSelected(const QString& name) const;
+
+    /**
+     * Returns how long a single benchmark is run.
+     */
+    std::chrono::milliseconds timeBudget() const;
+
+    /**
+     * Sets how long a single benchmark is run.
+     */
+    void setTimeBudget(const std::chrono::milliseconds& budget);
+
+    /**
+     * Measures how long one invocation of the @p body takes.
+     */
+    void measure(const QString& name, std::function<void()> body);
+
+    /**
+     * Records the @p metrics of a benchmark that measures itself.
+     */
+    void record(const QString& name, const QJsonObject& metrics);
+
+    /**
+     * Returns all results collected so far.
+     */
+    QJsonObject report() const;
+
+private:
+    QJsonArray m_results;
+    QRegularExpression m_filter;
+    std::chrono::milliseconds m_timeBudget;
+};
@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DrmBenchmarks.h"
+#include "BenchmarkRunner.h"
+
+#include "DrmBuffer.h"
+#include "DrmConnector.h"
+#include "DrmCrtc.h"
+#include "DrmDevice.h"
+#include "DrmDeviceManager.h"
+#include "DrmFrameScheduler.h"
+#include "DrmFrameTimeline.h"
+#include "DrmImage.h"
+#include "DrmOutput.h"
+#include "DrmPlane.h"
+#include "DrmSwapchain.h"
+#include "EDID.h"
+#include "NativeContext.h"
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QTimer>
+
+#include <drm_fourcc.h>
+
+#include <algorithm>
+
+// A 1920x1080 monitor with a name, a serial number and range limits.
+static const uint8_t s_edid[] = {
+    0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x12, 0x4d, 0x34, 0x12, 0x01, 0x00, 0x00, 0x00,
+    0x0c, 0x1d, 0x01, 0x04, 0xa5, 0x3c, 0x22, 0x78, 0x3a, 0xee, 0x95, 0xa3, 0x54, 0x4c, 0x99, 0x26,
+    0x0f, 0x50, 0x54, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x3a, 0x80, 0x18, 0x71, 0x38, 0x2d, 0x40, 0x58, 0x2c,
+    0x45, 0x00, 0x56, 0x50, 0x21, 0x00, 0x00, 0x1e, 0x00, 0x00, 0x00, 0xfc, 0x00, 0x50, 0x6c, 0x61,
+    0x79, 0x67, 0x72, 0x6f, 0x75, 0x6e, 0x64, 0x0a, 0x20, 0x20, 0x00, 0x00, 0x00, 0xff, 0x00, 0x50,
+    0x47, 0x30, 0x30, 0x30, 0x31, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x00, 0x00, 0x00, 0xfd,
+    0x00, 0x38, 0x4c, 0x1e, 0x53, 0x11, 0x00, 0x0a, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x00, 0x44,
+};
+
+static std::unique_ptr<NativeContext> createVirtualContext(int outputCount)
+{
+    const QByteArray name = QByteArrayLiteral("DRM_PLAYGROUND_VIRTUAL_OUTPUTS");
+    const QByteArray previousValue = qgetenv(name.constData());
+
+    qputenv(name.constData(), QByteArray::number(outputCount));
+    auto context = std::make_unique<NativeContext>();
+
+    if (previousValue.isNull())
+        qunsetenv(name.constData());
+    else
+        qputenv(name.constData(), previousValue);
+
+    if (!context->isValid())
+        return nullptr;
+
+    return context;
+}
+
+static std::unique_ptr<NativeContext> createHardwareContext()
+{
+    auto context = std::make_unique<NativeContext>();
+
+    // The GPUs are opened in the background.
+    if (!context->isReady()) {
+        QEventLoop loop;
+        QObject::connect(context.get(), &NativeContext::ready, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+
+    if (!context->isValid())
+        return nullptr;
+
+    return context;
+}
+
+static DrmOutput* firstOutput(const NativeContext* context)
+{
+    const DrmDevice* device = context->deviceManager()->primaryDevice();
+    if (device->outputs().isEmpty())
+        return nullptr;
+
+    return device->outputs().first();
+}
+
+static bool presentFrame(DrmOutput* output)
+{
+    DrmImage* image = output->swapchain()->acquire();
+    if (!image)
+        return false;
+
+    output->setPendingImage(image);
+    output->present();
+
+    return true;
+}
+
+DrmBenchmarks::DrmBenchmarks(BenchmarkRunner* runner)
+    : m_runner(runner)
+{
+}
+
+void DrmBenchmarks::run(bool useHardware)
+{
+    benchmarkPresent();
+    benchmarkSwapchain();
+    benchmarkPropertyScan();
+    benchmarkEdid();
+
+    for (int outputCount : { 1, 8, 32 })
+        benchmarkRouting(outputCount);
+
+    for (int outputCount : { 8, 32 })
+        benchmarkEventLookup(outputCount);
+
+    for (int outputCount : { 1, 32, 256 }) {
+        const QString name = QStringLiteral("flip/virtual/%1").arg(outputCount);
+        if (!m_runner->isSelected(name))
+            continue;
+        std::unique_ptr<NativeContext> context = createVirtualContext(outputCount);
+        if (context)
+            benchmarkFlips(name, context.get());
+    }
+
+    if (useHardware && m_runner->isSelected(QStringLiteral("flip/hardware"))) {
+        std::unique_ptr<NativeContext> context = createHardwareContext();
+        if (context)
+            benchmarkFlips(QStringLiteral("flip/hardware"), context.get());
+    }
+
+    if (useHardware)
+        benchmarkModifiers();
+}
+
+void DrmBenchmarks::benchmarkPresent()
+{
+    const QString fullName = QStringLiteral("present/full-damage");
+    const QString partialName = QStringLiteral("present/partial-damage");
+    if (!m_runner->isSelected(fullName) && !m_runner->isSelected(partialName))
+        return;
+
+    std::unique_ptr<NativeContext> context = createVirtualContext(1);
+    if (!context)
+        return;
+
+    DrmOutput* output = firstOutput(context.get());
+    if (!output || !output->swapchain())
+        return;
+
+    // Get the modeset out of the way, it's not part of a regular frame.
+    if (!presentFrame(output))
+        return;
+    output->device()->waitIdle();
+
+    const auto present = [output](const QRegion& damage) {
+        DrmImage* image = output->swapchain()->acquire();
+        output->setPendingImage(image);
+        output->present(damage);
+        image->release();
+    };
+
+    m_runner->measure(fullName, [&] {
+        present(QRegion());
+    });
+
+    const QRegion damage = QRegion(0, 0, 64, 64) + QRegion(512, 256, 128, 32);
+    m_runner->measure(partialName, [&] {
+        present(damage);
+    });
+
+    // Leave an image that is still owned by the output for the final commit.
+    presentFrame(output);
+}
+
+void DrmBenchmarks::benchmarkSwapchain()
+{
+    const QString name = QStringLiteral("swapchain/acquire-release");
+    if (!m_runner->isSelected(name))
+        return;
+
+    std::unique_ptr<NativeContext> context = createVirtualContext(1);
+    if (!context)
+        return;
+
+    DrmOutput* output = firstOutput(context.get());
+    if (!output || !output->swapchain())
+        return;
+
+    DrmSwapchain* swapchain = output->swapchain();
+    m_runner->measure(name, [swapchain] {
+        DrmImage* image = swapchain->acquire();
+        swapchain->markPresented(image);
+        image->release();
+    });
+}
+
+void DrmBenchmarks::benchmarkPropertyScan()
+{
+    const QString planeName = QStringLiteral("properties/scan-plane");
+    const QString connectorName = QStringLiteral("properties/scan-connector");
+    const QString requestsName = QStringLiteral("properties/startup-requests");
+    if (!m_runner->isSelected(planeName) && !m_runner->isSelected(connectorName)
+        && !m_runner->isSelected(requestsName))
+        return;
+
+    std::unique_ptr<NativeContext> context = createVirtualContext(4);
+    if (!context)
+        return;
+
+    DrmDevice* device = context->deviceManager()->primaryDevice();
+    if (device->planes().isEmpty() || device->connectors().isEmpty())
+        return;
+
+    // Each request stands for one ioctl, or two if the kernel has to be asked
+    // for the size of the reply first.
+    if (m_runner->isSelected(requestsName)) {
+        const DrmPropertyStatistics statistics = device->propertyStatistics();
+
+        QJsonObject metrics;
+        metrics[QStringLiteral("crtcs")] = device->crtcs().count();
+        metrics[QStringLiteral("planes")] = device->planes().count();
+        metrics[QStringLiteral("connectors")] = device->connectors().count();
+        metrics[QStringLiteral("objectRequests")] = double(statistics.objectRequests);
+        metrics[QStringLiteral("propertyRequests")] = double(statistics.propertyRequests);
+        metrics[QStringLiteral("uncachedPropertyRequests")] = double(statistics.listedProperties);
+        m_runner->record(requestsName, metrics);
+    }
+
+    const uint32_t planeId = device->planes().first()->id();
+    m_runner->measure(planeName, [device, planeId] {
+        DrmPlane plane(device, planeId);
+    });
+
+    const uint32_t connectorId = device->connectors().first()->id();
+    m_runner->measure(connectorName, [device, connectorId] {
+        DrmConnector connector(device, connectorId);
+    });
+}
+
+void DrmBenchmarks::benchmarkEdid()
+{
+    m_runner->measure(QStringLiteral("edid/parse"), [] {
+        EDID edid(s_edid, sizeof(s_edid));
+        Q_UNUSED(edid)
+    });
+}
+
+void DrmBenchmarks::benchmarkRouting(int outputCount)
+{
+    const QString searchName = QStringLiteral("routing/search/%1").arg(outputCount);
+    const QString cachedName = QStringLiteral("routing/cached/%1").arg(outputCount);
+    if (!m_runner->isSelected(searchName) && !m_runner->isSelected(cachedName))
+        return;
+
+    std::unique_ptr<NativeContext> context = createVirtualContext(outputCount);
+    if (!context)
+        return;
+
+    DrmDevice* device = context->deviceManager()->primaryDevice();
+
+    // Only the search is measured, applying the routing to the outputs isn't.
+    m_runner->measure(searchName, [device] {
+        DrmCrtcMap routing;
+        device->clearRoutingCache();
+        device->findRouting(&routing);
+    });
+
+    m_runner->measure(cachedName, [device] {
+        DrmCrtcMap routing;
+        device->findRouting(&routing);
+    });
+}
+
+void DrmBenchmarks::benchmarkEventLookup(int outputCount)
+{
+    const QString name = QStringLiteral("events/lookup/%1").arg(outputCount);
+    if (!m_runner->isSelected(name))
+        return;
+
+    std::unique_ptr<NativeContext> context = createVirtualContext(outputCount);
+    if (!context)
+        return;
+
+    DrmDevice* device = context->deviceManager()->primaryDevice();
+
+    // Page flip events carry only the CRTC id, which has to be mapped to an
+    // output before the event can be delivered. One iteration is a burst of
+    // events, one for every CRTC on the device.
+    QVector<uint32_t> crtcIds;
+    for (const DrmCrtc* crtc : device->crtcs())
+        crtcIds << crtc->id();
+
+    m_runner->measure(name, [device, crtcIds] {
+        static volatile int found = 0;
+        for (uint32_t crtcId : crtcIds) {
+            if (device->findOutput(crtcId))
+                found = found + 1;
+        }
+    });
+}
+
+void DrmBenchmarks::benchmarkModifiers()
+{
+    const QString linearName = QStringLiteral("modifiers/flip-throughput-linear");
+    const QString negotiatedName = QStringLiteral("modifiers/flip-throughput-negotiated");
+    if (!m_runner->isSelected(linearName) && !m_runner->isSelected(negotiatedName))
+        return;
+
+    // Virtual devices don't care about the layout, so this needs the GPU.
+    std::unique_ptr<NativeContext> context = createHardwareContext();
+    if (!context)
+        return;
+
+    DrmOutputList outputs;
+    for (const DrmDevice* device : context->deviceManager()->devices())
+        outputs << device->outputs();
+
+    // This measures how many page flips the display engine completes while
+    // scanning out linear or negotiated layouts on all outputs. The images
+    // come from GBM, which the CPU renderer doesn't draw into, so the cost of
+    // rendering into either layout is not part of the numbers.
+    const auto run = [&](const QString& name, const QVector<uint64_t>& modifiers) {
+        if (!m_runner->isSelected(name))
+            return;
+
+        for (DrmDevice* device : context->deviceManager()->devices())
+            device->waitIdle();
+
+        for (DrmOutput* output : outputs)
+            output->setSwapchainModifiers(modifiers);
+
+        QJsonArray modifiers;
+        for (const DrmOutput* output : outputs) {
+            const DrmSwapchain* swapchain = output->swapchain();
+            if (!swapchain || !swapchain->isValid())
+                continue;
+            const uint64_t modifier = swapchain->images().first()->buffer()->modifier();
+            modifiers << QStringLiteral("0x%1").arg(modifier, 16, 16, QLatin1Char('0'));
+        }
+
+        QJsonObject metrics;
+        metrics[QStringLiteral("modifiers")] = modifiers;
+        benchmarkFlips(name, context.get(), metrics);
+    };
+
+    run(linearName, { DRM_FORMAT_MOD_LINEAR });
+    run(negotiatedName, {});
+}
+
+void DrmBenchmarks::benchmarkFlips(const QString& name, NativeContext* context,
+    const QJsonObject& extraMetrics)
+{
+    DrmOutputList outputs;
+    for (const DrmDevice* device : context->deviceManager()->devices())
+        outputs << device->outputs();
+
+    if (outputs.isEmpty())
+        return;
+
+    // Keep every output busy, new frames are requested as soon as possible.
+    QTimer repaintTimer;
+    repaintTimer.setTimerType(Qt::PreciseTimer);
+    repaintTimer.setInterval(1);
+    QObject::connect(&repaintTimer, &QTimer::timeout, [&outputs] {
+        for (DrmOutput* output : outputs) {
+            const DrmMode mode = output->desiredMode();
+            output->frameScheduler()->scheduleRepaint(QRect(0, 0, mode.width(), mode.height()));
+        }
+    });
+
+    // Let the modesets settle before measuring.
+    QEventLoop loop;
+    repaintTimer.start();
+    QTimer::singleShot(200, &loop, &QEventLoop::quit);
+    loop.exec();
+
+    for (DrmOutput* output : outputs)
+        output->frameScheduler()->resetStatistics();
+
+    const auto start = std::chrono::steady_clock::now();
+    QTimer::singleShot(int(m_runner->timeBudget().count()), &loop, &QEventLoop::quit);
+    loop.exec();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    repaintTimer.stop();
+
+    uint64_t presentedFrames = 0;
+    uint64_t missedFrames = 0;
+    QVector<double> latencies;
+    for (const DrmOutput* output : outputs) {
+        const DrmFrameStatistics statistics = output->frameScheduler()->statistics();
+        presentedFrames += statistics.presentedFrames;
+        missedFrames += statistics.missedFrames;
+
+        for (const DrmFrameTiming& timing : output->frameTimeline()->timings()) {
+            if (timing.isPresented)
+                latencies << (timing.flip - timing.renderStart).count() / 1000000.0;
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    QJsonObject metrics = extraMetrics;
+    metrics[QStringLiteral("outputs")] = outputs.count();
+    metrics[QStringLiteral("seconds")] = elapsed.count();
+    metrics[QStringLiteral("presentedFrames")] = double(presentedFrames);
+    metrics[QStringLiteral("missedFrames")] = double(missedFrames);
+    metrics[QStringLiteral("framesPerSecond")] = presentedFrames / elapsed.count();
+    metrics[QStringLiteral("framesPerSecondPerOutput")] = presentedFrames / elapsed.count() / outputs.count();
+    if (!latencies.isEmpty())
+        metrics[QStringLiteral("medianLatencyMs")] = latencies.at(latencies.count() / 2);
+
+    m_runner->record(name, metrics);
+}
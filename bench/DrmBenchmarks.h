@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <QJsonObject>
+#include <QString>
+
+#include <memory>
+
+class BenchmarkRunner;
+class NativeContext;
+
+/**
+ * Benchmarks of the hot paths in the DRM backend.
+ *
+ * Unless stated otherwise, the benchmarks run on virtual devices so that the
+ * results don't depend on the GPU of the machine they run on.
+ */
+class DrmBenchmarks {
+public:
+    explicit DrmBenchmarks(BenchmarkRunner* runner);
+
+    /**
+     * Runs all selected benchmarks. If @p useHardware is @c true, the flip
+     * throughput is also measured on the GPUs of the machine, e.g. vkms, once
+     * as is and once with linear and with negotiated buffer layouts.
+     */
+    void run(bool useHardware);
+
+private:
+    void benchmarkPresent();
+    void benchmarkSwapchain();
+    void benchmarkPropertyScan();
+    void benchmarkEdid();
+    void benchmarkRouting(int outputCount);
+    void benchmarkEventLookup(int outputCount);
+    void benchmarkModifiers();
+    void benchmarkFlips(const QString& name, NativeContext* context,
+        const QJsonObject& extraMetrics = QJsonObject());
+
+    BenchmarkRunner* m_runner;
+};
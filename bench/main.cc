@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "BenchmarkRunner.h"
+#include "DrmBenchmarks.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QJsonDocument>
+
+#include <cstdio>
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Benchmarks of the DRM backend"));
+    parser.addHelpOption();
+
+    const QCommandLineOption filterOption(QStringLiteral("filter"),
+        QStringLiteral("Only run benchmarks whose name matches the regular expression."),
+        QStringLiteral("pattern"));
+    const QCommandLineOption timeBudgetOption(QStringLiteral("time-budget"),
+        QStringLiteral("How long to run each benchmark, in milliseconds."),
+        QStringLiteral("ms"), QStringLiteral("1000"));
+    const QCommandLineOption outputOption(QStringLiteral("output"),
+        QStringLiteral("Write the JSON report to the file instead of stdout."),
+        QStringLiteral("file"));
+    const QCommandLineOption hardwareOption(QStringLiteral("hardware"),
+        QStringLiteral("Also measure flip throughput on the GPUs of this machine, e.g. vkms."));
+
+    parser.addOption(filterOption);
+    parser.addOption(timeBudgetOption);
+    parser.addOption(outputOption);
+    parser.addOption(hardwareOption);
+    parser.process(app);
+
+    BenchmarkRunner runner;
+    runner.setFilter(QRegularExpression(parser.value(filterOption)));
+    runner.setTimeBudget(std::chrono::milliseconds(parser.value(timeBudgetOption).toInt()));
+
+    DrmBenchmarks benchmarks(&runner);
+    benchmarks.run(parser.isSet(hardwareOption));
+
+    const QByteArray report = QJsonDocument(runner.report()).toJson();
+
+    if (!parser.isSet(outputOption)) {
+        fwrite(report.constData(), 1, report.size(), stdout);
+        return 0;
+    }
+
+    QFile file(parser.value(outputOption));
+    if (!file.open(QIODevice::WriteOnly))
+        return -1;
+    if (file.write(report) != report.size())
+        return -1;
+
+    return 0;
+}
@@ -17,10 +17,33 @@
  */
 
 #include "Compositor.h"
+#include "DrmAllocator.h"
+#include "DrmBuffer.h"
+#include "DrmDevice.h"
+#include "DrmDeviceManager.h"
+#include "DrmFrameScheduler.h"
+#include "DrmImage.h"
+#include "DrmOutput.h"
+#include "DrmOutputManager.h"
+#include "NativeContext.h"
 
-Compositor::Compositor(QObject* parent)
+#include <drm_fourcc.h>
+
+#include <algorithm>
+
+// The color of the background of every output.
+static const uint32_t s_backgroundColor = 0xff203040;
+
+Compositor::Compositor(NativeContext* context, QObject* parent)
     : QObject(parent)
+    , m_context(context)
 {
+    for (DrmDevice* device : context->deviceManager()->devices()) {
+        for (DrmOutput* output : device->outputs())
+            addOutput(output);
+    }
+
+    connect(context->outputManager(), &DrmOutputManager::outputPrepared, this, &Compositor::addOutput);
 }
 
 Compositor::~Compositor()
@@ -31,3 +54,48 @@ bool Compositor::isValid() const
 {
     return true;
 }
+
+static void fillImage(DrmImage* image, uint32_t color)
+{
+    auto bits = static_cast<uint8_t*>(image->data());
+    if (!bits)
+        return;
+
+    const DrmBuffer* buffer = image->buffer();
+    for (uint32_t y = 0; y < buffer->height(); ++y) {
+        auto row = reinterpret_cast<uint32_t*>(bits + y * image->stride());
+        std::fill(row, row + buffer->width(), color);
+    }
+}
+
+void Compositor::addOutput(DrmOutput* output)
+{
+    const DrmMode mode = output->desiredMode();
+    if (!mode.width() || !mode.height())
+        return;
+
+    DrmAllocator* allocator = output->device()->allocator();
+
+    // The background covers the whole output, so the plane assigner can put it
+    // onto the primary plane as it is.
+    DrmImage* image = allocator->allocate(mode.width(), mode.height(), DRM_FORMAT_XRGB8888, {});
+    if (!image)
+        return;
+
+    fillImage(image, s_backgroundColor);
+    m_backgrounds.insert(output, image);
+
+    DrmLayer layer;
+    layer.image = image;
+    layer.sourceRect = QRect(0, 0, mode.width(), mode.height());
+    layer.targetRect = layer.sourceRect;
+    layer.isOpaque = true;
+
+    output->setLayers({ layer });
+    output->frameScheduler()->scheduleRepaint(layer.targetRect);
+
+    // The output has let go of all its images by the time it's destroyed.
+    connect(output, &QObject::destroyed, this, [this, output, allocator]() {
+        allocator->recycle(m_backgrounds.take(output));
+    });
+}
@@ -18,13 +18,18 @@
 
 #pragma once
 
+#include "globals.h"
+
+#include <QHash>
 #include <QObject>
 
+class NativeContext;
+
 class Compositor : public QObject {
     Q_OBJECT
 
 public:
-    explicit Compositor(QObject* parent = nullptr);
+    explicit Compositor(NativeContext* context, QObject* parent = nullptr);
     ~Compositor() override;
 
     /**
@@ -33,5 +38,10 @@ public:
     bool isValid() const;
 
 private:
+    void addOutput(DrmOutput* output);
+
+    NativeContext* m_context;
+    QHash<DrmOutput*, DrmImage*> m_backgrounds;
+
     Q_DISABLE_COPY(Compositor)
 };
@@ -17,6 +17,9 @@
  */
 
 #include "DrmAllocator.h"
+#include "DrmImage.h"
+
+#include <QVector>
 
 DrmAllocator::DrmAllocator(QObject* parent)
     : QObject(parent)
@@ -26,3 +29,14 @@ DrmAllocator::DrmAllocator(QObject* parent)
 DrmAllocator::~DrmAllocator()
 {
 }
+
+QVector<uint64_t> DrmAllocator::modifiers(uint32_t format) const
+{
+    Q_UNUSED(format)
+    return QVector<uint64_t>();
+}
+
+void DrmAllocator::recycle(DrmImage* image)
+{
+    delete image;
+}
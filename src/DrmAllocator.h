@@ -34,12 +34,26 @@ public:
      */
     virtual bool isValid() const = 0;
 
+    /**
+     * Returns modifiers of the layouts that images with the given format can
+     * be rendered into. An empty list means that only the implicit layout,
+     * chosen by the driver, is supported.
+     */
+    virtual QVector<uint64_t> modifiers(uint32_t format) const;
+
     /**
      * Allocates an image.
      */
     virtual DrmImage* allocate(uint32_t width, uint32_t height, uint32_t format,
         const QVector<uint64_t>& modifiers) = 0;
 
+    /**
+     * Gives back an image that is no longer used by a swapchain. The allocator
+     * may keep it around and hand it out again from allocate(), otherwise the
+     * image is destroyed.
+     */
+    virtual void recycle(DrmImage* image);
+
 private:
     Q_DISABLE_COPY(DrmAllocator)
 };
@@ -17,19 +17,29 @@
  */
 
 #include "DrmBackend.h"
+#include "Compositor.h"
 #include "NativeContext.h"
 
 DrmBackend::DrmBackend(QObject* parent)
     : QObject(parent)
 {
     m_context = new NativeContext(this);
-    if (!m_context->isValid())
-        return;
+    connect(m_context, &NativeContext::ready, this, &DrmBackend::initialize);
 }
 
 DrmBackend::~DrmBackend()
 {
+    // The compositor gets its images back as the outputs go away.
     delete m_context;
+    delete m_compositor;
+}
+
+void DrmBackend::initialize()
+{
+    if (m_context->isValid())
+        m_compositor = new Compositor(m_context, this);
+
+    emit ready();
 }
 
 bool DrmBackend::isValid() const
@@ -22,6 +22,7 @@
 
 #include <QObject>
 
+class Compositor;
 class NativeContext;
 
 class DrmBackend : public QObject {
@@ -33,11 +34,22 @@ public:
 
     /**
      * Whether this backend has been initialized successfully.
+     *
+     * The answer is only final once ready() has been emitted.
      */
     bool isValid() const;
 
+signals:
+    /**
+     * This signal is emitted once the backend has been initialized.
+     */
+    void ready();
+
 private:
+    void initialize();
+
     NativeContext* m_context;
+    Compositor* m_compositor = nullptr;
 
     Q_DISABLE_COPY(DrmBackend)
 };
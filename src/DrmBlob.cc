@@ -23,15 +23,14 @@
 
 DrmBlob::DrmBlob(DrmDevice* device, const void* data, size_t size)
     : m_device(device)
-    , m_id(0)
+    , m_id(device->createPropertyBlob(data, size))
 {
-    drmModeCreatePropertyBlob(device->fd(), data, size, &m_id);
 }
 
 DrmBlob::~DrmBlob()
 {
     if (m_id)
-        drmModeDestroyPropertyBlob(m_device->fd(), m_id);
+        m_device->destroyPropertyBlob(m_id);
 }
 
 bool DrmBlob::isValid() const
@@ -25,7 +25,7 @@
 DrmBuffer::~DrmBuffer()
 {
     if (m_id)
-        drmModeRmFB(m_device->fd(), m_id);
+        m_device->removeFramebuffer(m_id);
 }
 
 bool DrmBuffer::isValid() const
@@ -58,14 +58,18 @@ uint32_t DrmBuffer::height() const
     return m_height;
 }
 
+uint64_t DrmBuffer::modifier() const
+{
+    return m_modifier;
+}
+
 DrmBuffer* DrmBuffer::create(DrmDevice* device, uint32_t width, uint32_t height,
     uint32_t format, std::array<uint32_t, 4> handles, std::array<uint32_t, 4> pitches,
     std::array<uint32_t, 4> offsets)
 {
-    uint32_t id;
-
-    if (drmModeAddFB2(device->fd(), width, height, format, handles.data(),
-            pitches.data(), offsets.data(), &id, 0))
+    const uint32_t id = device->addFramebuffer(width, height, format, handles.data(),
+        pitches.data(), offsets.data(), nullptr);
+    if (!id)
         return nullptr;
 
     auto buffer = new DrmBuffer();
@@ -74,6 +78,7 @@ DrmBuffer* DrmBuffer::create(DrmDevice* device, uint32_t width, uint32_t height,
     buffer->m_format = format;
     buffer->m_width = width;
     buffer->m_height = height;
+    buffer->m_modifier = DRM_FORMAT_MOD_INVALID;
 
     return buffer;
 }
@@ -82,15 +87,12 @@ DrmBuffer* DrmBuffer::create(DrmDevice* device, uint32_t width, uint32_t height,
     uint32_t format, std::array<uint32_t, 4> handles, std::array<uint32_t, 4> pitches,
     std::array<uint32_t, 4> offsets, std::array<uint64_t, 4> modifiers)
 {
-    uint32_t id;
-
     if (modifiers[0] == DRM_FORMAT_MOD_INVALID)
         return create(device, width, height, format, handles, pitches, offsets);
 
-    const uint32_t flags = DRM_MODE_FB_MODIFIERS;
-    if (drmModeAddFB2WithModifiers(device->fd(), width, height, format,
-            handles.data(), pitches.data(), offsets.data(), modifiers.data(),
-            &id, flags))
+    const uint32_t id = device->addFramebuffer(width, height, format, handles.data(),
+        pitches.data(), offsets.data(), modifiers.data());
+    if (!id)
         return nullptr;
 
     auto buffer = new DrmBuffer();
@@ -99,6 +101,7 @@ DrmBuffer* DrmBuffer::create(DrmDevice* device, uint32_t width, uint32_t height,
     buffer->m_format = format;
     buffer->m_width = width;
     buffer->m_height = height;
+    buffer->m_modifier = modifiers[0];
 
     return buffer;
 }
@@ -57,6 +57,12 @@ public:
      */
     uint32_t height() const;
 
+    /**
+     * Returns the format modifier of this frame buffer, or DRM_FORMAT_MOD_INVALID
+     * if the layout is chosen implicitly by the driver.
+     */
+    uint64_t modifier() const;
+
     static DrmBuffer* create(DrmDevice* device, uint32_t width, uint32_t height,
         uint32_t format, std::array<uint32_t, 4> handles, std::array<uint32_t, 4> pitches,
         std::array<uint32_t, 4> offsets);
@@ -71,4 +77,5 @@ private:
     uint32_t m_format;
     uint32_t m_width;
     uint32_t m_height;
+    uint64_t m_modifier;
 };
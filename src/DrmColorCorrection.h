@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <QGenericMatrix>
+#include <QVector3D>
+#include <QVector>
+
+/**
+ * Color correction that the display engine applies to an output, e.g. for
+ * night light or calibration.
+ *
+ * Pixels go through the degamma curves, the color matrix and then the gamma
+ * curves. Curves are sampled uniformly over [0, 1], with one value per
+ * channel, and resampled to the size of the hardware tables. An empty curve
+ * leaves the pixels alone.
+ */
+struct DrmColorCorrection {
+    /**
+     * Curves that take pixels to linear light, before the color matrix.
+     */
+    QVector<QVector3D> degamma;
+
+    /**
+     * The color matrix, applied to linear RGB values.
+     */
+    QMatrix3x3 matrix;
+
+    /**
+     * Curves that take pixels back to the encoding of the display.
+     */
+    QVector<QVector3D> gamma;
+
+    /**
+     * Returns whether this correction doesn't change any pixels.
+     */
+    bool isIdentity() const
+    {
+        return degamma.isEmpty() && matrix.isIdentity() && gamma.isEmpty();
+    }
+};
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DrmCommitThread.h"
+
+#include <QSocketNotifier>
+
+#include <xf86drm.h>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static std::chrono::nanoseconds currentTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+static void signalEventFd(int fd)
+{
+    const uint64_t value = 1;
+    if (write(fd, &value, sizeof(value)) != sizeof(value))
+        return;
+}
+
+static void clearEventFd(int fd)
+{
+    uint64_t value;
+    if (read(fd, &value, sizeof(value)) != sizeof(value))
+        return;
+}
+
+DrmCommitThread::DrmCommitThread(int fd, QObject* parent)
+    : QThread(parent)
+    , m_hasOverflow(false)
+    , m_isStopping(false)
+    , m_fd(fd)
+{
+    m_jobEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_jobEventFd == -1)
+        return;
+
+    m_completionEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_completionEventFd == -1)
+        return;
+
+    m_completionNotifier = new QSocketNotifier(m_completionEventFd, QSocketNotifier::Read, this);
+    connect(m_completionNotifier, &QSocketNotifier::activated,
+        this, &DrmCommitThread::dispatchCompletions);
+
+    start(QThread::TimeCriticalPriority);
+}
+
+DrmCommitThread::~DrmCommitThread()
+{
+    m_isStopping.store(true);
+    if (m_jobEventFd != -1)
+        signalEventFd(m_jobEventFd);
+    wait();
+
+    // Commits that never made it to the kernel.
+    Job job;
+    while (m_jobs.pop(&job))
+        drmModeAtomicFree(job.request);
+
+    if (m_completionEventFd != -1)
+        close(m_completionEventFd);
+    if (m_jobEventFd != -1)
+        close(m_jobEventFd);
+}
+
+bool DrmCommitThread::isValid() const
+{
+    return m_completionNotifier;
+}
+
+bool DrmCommitThread::submit(drmModeAtomicReq* request, uint32_t flags, uint64_t serial)
+{
+    drmModeAtomicReq* copy = drmModeAtomicDuplicate(request);
+    if (!copy)
+        return false;
+
+    if (!m_jobs.push({ copy, flags, serial })) {
+        drmModeAtomicFree(copy);
+        return false;
+    }
+
+    signalEventFd(m_jobEventFd);
+
+    return true;
+}
+
+void DrmCommitThread::run()
+{
+    pollfd fds[2] = {};
+    fds[0].fd = m_jobEventFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_fd;
+    fds[1].events = POLLIN;
+
+    drmEventContext context = {};
+    context.version = 3;
+    context.page_flip_handler2 = handlePageFlip;
+
+    while (!m_isStopping.load()) {
+        if (poll(fds, 2, -1) < 0)
+            continue;
+
+        if (fds[0].revents & POLLIN) {
+            clearEventFd(m_jobEventFd);
+            if (flushOverflow())
+                signalEventFd(m_completionEventFd);
+            processJobs();
+        }
+
+        if (fds[1].revents & POLLIN)
+            drmHandleEvent(m_fd, &context);
+    }
+}
+
+void DrmCommitThread::processJobs()
+{
+    Job job;
+    while (!m_isStopping.load() && m_jobs.pop(&job)) {
+        Completion completion = {};
+        completion.type = Completion::Commit;
+        completion.serial = job.serial;
+        completion.submitTime = currentTime();
+        completion.success = !drmModeAtomicCommit(m_fd, job.request, job.flags, this);
+        completion.returnTime = currentTime();
+
+        drmModeAtomicFree(job.request);
+
+        complete(completion);
+    }
+}
+
+bool DrmCommitThread::flushOverflow()
+{
+    int count = 0;
+    while (count < m_overflow.count() && m_completions.push(m_overflow.at(count)))
+        count++;
+
+    m_overflow.remove(0, count);
+    m_hasOverflow.store(!m_overflow.isEmpty());
+
+    return count;
+}
+
+void DrmCommitThread::complete(const Completion& completion)
+{
+    // If the queue is full, the main thread is stalled. Rather than waiting for
+    // it here, which would hold up page flip events of other CRTCs, the
+    // completion is kept aside. The main thread asks for the rest once it has
+    // made room.
+    flushOverflow();
+    if (!m_overflow.isEmpty() || !m_completions.push(completion)) {
+        m_overflow.append(completion);
+        m_hasOverflow.store(true);
+    }
+
+    signalEventFd(m_completionEventFd);
+}
+
+void DrmCommitThread::handlePageFlip(int, unsigned int sequence, unsigned int tv_sec,
+    unsigned int tv_usec, unsigned int crtc_id, void* user_data)
+{
+    DrmCommitThread* thread = static_cast<DrmCommitThread*>(user_data);
+
+    Completion completion = {};
+    completion.type = Completion::PageFlip;
+    completion.crtcId = crtc_id;
+    completion.sequence = sequence;
+    completion.returnTime = std::chrono::seconds(tv_sec) + std::chrono::microseconds(tv_usec);
+
+    thread->complete(completion);
+}
+
+void DrmCommitThread::dispatchCompletions()
+{
+    clearEventFd(m_completionEventFd);
+
+    Completion completion;
+    while (m_completions.pop(&completion)) {
+        switch (completion.type) {
+        case Completion::Commit:
+            emit commitCompleted(completion.serial, completion.success,
+                completion.submitTime, completion.returnTime);
+            break;
+        case Completion::PageFlip:
+            emit pageFlipped(completion.crtcId, completion.sequence, completion.returnTime);
+            break;
+        }
+    }
+
+    if (m_hasOverflow.load())
+        signalEventFd(m_jobEventFd);
+}
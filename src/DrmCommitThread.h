@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "SpscQueue.h"
+
+#include <QThread>
+#include <QVector>
+
+#include <xf86drmMode.h>
+
+#include <atomic>
+#include <chrono>
+
+class QSocketNotifier;
+
+/**
+ * Submits atomic commits and dispatches page flip events of a DRM device.
+ *
+ * The thread owns the event handling of the device fd, so page flips are
+ * picked up on time no matter how busy the main thread is. Commits are handed
+ * to the thread through a lock-free queue, and results travel back the same
+ * way. The signals are emitted on the thread this object lives in.
+ */
+class DrmCommitThread : public QThread {
+    Q_OBJECT
+
+public:
+    explicit DrmCommitThread(int fd, QObject* parent = nullptr);
+    ~DrmCommitThread() override;
+
+    /**
+     * Whether the thread could be set up.
+     */
+    bool isValid() const;
+
+    /**
+     * Queues an atomic commit. The thread works on a copy of the @p request,
+     * so it can be modified as soon as this function returns.
+     *
+     * The result is reported by commitCompleted() with the given @p serial. If
+     * the commit couldn't be queued, @c false is returned.
+     */
+    bool submit(drmModeAtomicReq* request, uint32_t flags, uint64_t serial);
+
+signals:
+    /**
+     * This signal is emitted when the commit with the given @p serial has
+     * returned from the kernel.
+     */
+    void commitCompleted(uint64_t serial, bool success,
+        std::chrono::nanoseconds submitTime, std::chrono::nanoseconds returnTime);
+
+    /**
+     * This signal is emitted when a page flip on the given CRTC has completed.
+     */
+    void pageFlipped(uint32_t crtcId, uint sequence, std::chrono::nanoseconds timestamp);
+
+protected:
+    void run() override;
+
+private slots:
+    void dispatchCompletions();
+
+private:
+    struct Job {
+        drmModeAtomicReq* request;
+        uint32_t flags;
+        uint64_t serial;
+    };
+
+    struct Completion {
+        enum Type {
+            Commit,
+            PageFlip,
+        };
+
+        Type type;
+        uint64_t serial;
+        bool success;
+        uint32_t crtcId;
+        uint sequence;
+        std::chrono::nanoseconds submitTime;
+        std::chrono::nanoseconds returnTime;
+    };
+
+    void processJobs();
+    bool flushOverflow();
+    void complete(const Completion& completion);
+    static void handlePageFlip(int fd, unsigned int sequence, unsigned int tv_sec,
+        unsigned int tv_usec, unsigned int crtc_id, void* user_data);
+
+    SpscQueue<Job, 64> m_jobs;
+    SpscQueue<Completion, 256> m_completions;
+
+    // Completions that didn't fit into the queue, only touched by the thread.
+    QVector<Completion> m_overflow;
+    std::atomic<bool> m_hasOverflow;
+    QSocketNotifier* m_completionNotifier = nullptr;
+    std::atomic<bool> m_isStopping;
+    int m_fd;
+    int m_jobEventFd = -1;
+    int m_completionEventFd = -1;
+
+    Q_DISABLE_COPY(DrmCommitThread)
+};
@@ -20,8 +20,14 @@
 #include "DrmDevice.h"
 #include "DrmMode.h"
 #include "DrmPointer.h"
+#include "DrmProperty.h"
 #include "EDID.h"
 
+static const DrmPropertyBinding<ConnectorProperties> connectorBindings[] = {
+    { "CRTC_ID", &ConnectorProperties::crtcId },
+    { "DPMS", &ConnectorProperties::dpms },
+};
+
 static QString makeConnectorName(const drmModeConnector* connector)
 {
     QString type;
@@ -93,9 +99,9 @@ static bool checkOnlineStatus(const drmModeConnector* connector)
     return connector->connection == DRM_MODE_CONNECTED;
 }
 
-static std::unique_ptr<EDID> parseEDID(int fd, uint32_t blobId)
+static std::unique_ptr<EDID> parseEDID(const DrmDevice* device, uint32_t blobId)
 {
-    DrmScopedPointer<drmModePropertyBlobRes> blob(drmModeGetPropertyBlob(fd, blobId));
+    DrmScopedPointer<drmModePropertyBlobRes> blob(device->getPropertyBlob(blobId));
     if (!blob)
         return nullptr;
 
@@ -112,7 +118,7 @@ static DrmCrtcList findPossibleCrtcs(DrmDevice* device, const drmModeConnector*
 
     for (int i = 0; i < connector->count_encoders; ++i) {
         const uint32_t encoderId = connector->encoders[i];
-        DrmScopedPointer<drmModeEncoder> encoder(drmModeGetEncoder(device->fd(), encoderId));
+        DrmScopedPointer<drmModeEncoder> encoder(device->getEncoder(encoderId));
         if (!encoder)
             continue;
         mask |= encoder->possible_crtcs;
@@ -123,13 +129,12 @@ static DrmCrtcList findPossibleCrtcs(DrmDevice* device, const drmModeConnector*
 
 static DrmCrtc* findCrtc(DrmDevice* device, const drmModeConnector* connector)
 {
-    const int fd = device->fd();
     const uint32_t encoderId = connector->encoder_id;
 
     if (!encoderId)
         return nullptr;
 
-    DrmScopedPointer<drmModeEncoder> encoder(drmModeGetEncoder(fd, encoderId));
+    DrmScopedPointer<drmModeEncoder> encoder(device->getEncoder(encoderId));
     if (!encoder)
         return nullptr;
 
@@ -139,9 +144,7 @@ static DrmCrtc* findCrtc(DrmDevice* device, const drmModeConnector* connector)
 DrmConnector::DrmConnector(DrmDevice* device, uint32_t id)
     : DrmObject(device, id, DRM_MODE_OBJECT_CONNECTOR)
 {
-    const int fd = device->fd();
-
-    DrmScopedPointer<drmModeConnector> connector(drmModeGetConnector(fd, id));
+    DrmScopedPointer<drmModeConnector> connector(device->getConnector(id));
     if (!connector)
         return;
 
@@ -150,17 +153,16 @@ DrmConnector::DrmConnector(DrmDevice* device, uint32_t id)
     if (!m_isOnline)
         return;
 
-    forEachProperty([=](const drmModePropertyPtr property, uint64_t value) {
-        if (property->name == QByteArrayLiteral("CRTC_ID")) {
-            m_properties.crtcId = property->prop_id;
+    forEachProperty([=](const DrmProperty* property, uint64_t value) {
+        if (bindProperty(connectorBindings, property, m_properties))
             return;
-        }
-        if (property->name == QByteArrayLiteral("DPMS")) {
-            m_properties.dpms = property->prop_id;
+        if (property->name == QByteArrayLiteral("EDID")) {
+            m_edidBlobId = uint32_t(value);
+            m_edid = parseEDID(device, m_edidBlobId);
             return;
         }
-        if (property->name == QByteArrayLiteral("EDID")) {
-            m_edid = parseEDID(fd, uint32_t(value));
+        if (property->name == QByteArrayLiteral("vrr_capable")) {
+            m_isVrrCapable = value;
             return;
         }
     });
@@ -191,7 +193,12 @@ EDID* DrmConnector::edid() const
     return m_edid.get();
 }
 
-DrmModeList DrmConnector::modes() const
+uint32_t DrmConnector::edidBlobId() const
+{
+    return m_edidBlobId;
+}
+
+const DrmModeList& DrmConnector::modes() const
 {
     return m_modes;
 }
@@ -211,12 +218,22 @@ DrmCrtc* DrmConnector::crtc() const
     return m_crtc;
 }
 
-DrmCrtcList DrmConnector::possibleCrtcs() const
+void DrmConnector::setCrtc(DrmCrtc* crtc)
+{
+    m_crtc = crtc;
+}
+
+const DrmCrtcList& DrmConnector::possibleCrtcs() const
 {
     return m_possibleCrtcs;
 }
 
-ConnectorProperties DrmConnector::properties() const
+bool DrmConnector::isVrrCapable() const
+{
+    return m_isVrrCapable;
+}
+
+const ConnectorProperties& DrmConnector::properties() const
 {
     return m_properties;
 }
@@ -52,10 +52,19 @@ public:
      */
     EDID* edid() const;
 
+    /**
+     * Returns the id of the property blob that held the EDID when this
+     * connector was probed, or @c 0 if there was none.
+     *
+     * The kernel puts the EDID into a new blob when it changes, e.g. because
+     * another display has been plugged into the same port.
+     */
+    uint32_t edidBlobId() const;
+
     /**
      * Returns a list of supported display modes.
      */
-    DrmModeList modes() const;
+    const DrmModeList& modes() const;
 
     /**
      * Returns preferred mode for this connector.
@@ -67,15 +76,26 @@ public:
      */
     DrmCrtc* crtc() const;
 
+    /**
+     * Sets the CRTC that drives this connector, after a modeset has been
+     * committed.
+     */
+    void setCrtc(DrmCrtc* crtc);
+
     /**
      * Returns a list of CRTCs that can drive this connector.
      */
-    DrmCrtcList possibleCrtcs() const;
+    const DrmCrtcList& possibleCrtcs() const;
 
     /**
-     *
+     * Returns whether the connected display supports variable refresh rate.
+     */
+    bool isVrrCapable() const;
+
+    /**
+     * Returns ids of the properties of this connector.
      */
-    ConnectorProperties properties() const;
+    const ConnectorProperties& properties() const;
 
 private:
     ConnectorProperties m_properties;
@@ -84,5 +104,7 @@ private:
     DrmCrtc* m_crtc = nullptr;
     std::unique_ptr<EDID> m_edid;
     QString m_name;
+    uint32_t m_edidBlobId = 0;
     bool m_isOnline = false;
+    bool m_isVrrCapable = false;
 };
@@ -17,53 +17,66 @@
  */
 
 #include "DrmCrtc.h"
+#include "DrmDevice.h"
+#include "DrmPointer.h"
+#include "DrmProperty.h"
+
+#include <unistd.h>
+
+static const DrmPropertyBinding<CrtcProperties> crtcBindings[] = {
+    { "ACTIVE", &CrtcProperties::active },
+    { "CTM", &CrtcProperties::colorMatrix },
+    { "DEGAMMA_LUT", &CrtcProperties::degammaTable },
+    { "GAMMA_LUT", &CrtcProperties::gammaTable },
+    { "MODE_ID", &CrtcProperties::modeId },
+    { "OUT_FENCE_PTR", &CrtcProperties::outFencePtr },
+    { "VRR_ENABLED", &CrtcProperties::vrrEnabled },
+    { "rotation", &CrtcProperties::rotation },
+};
 
 DrmCrtc::DrmCrtc(DrmDevice* device, uint32_t id, uint32_t pipe)
     : DrmObject(device, id, DRM_MODE_OBJECT_CRTC)
     , m_pipe(pipe)
 {
-    forEachProperty([this](const drmModePropertyPtr property, uint64_t value) {
-        Q_UNUSED(value)
-        if (property->name == QByteArrayLiteral("ACTIVE")) {
-            m_properties.active = property->prop_id;
+    forEachProperty([this](const DrmProperty* property, uint64_t value) {
+        if (property->name == QByteArrayLiteral("ACTIVE"))
+            m_isActive = value;
+        if (bindProperty(crtcBindings, property, m_properties))
             return;
-        }
-        if (property->name == QByteArrayLiteral("DEGAMMA_LUT")) {
-            m_properties.degammaTable = property->prop_id;
-            return;
-        }
         if (property->name == QByteArrayLiteral("DEGAMMA_LUT_SIZE")) {
-            return;
-        }
-        if (property->name == QByteArrayLiteral("GAMMA_LUT")) {
-            m_properties.gammaTable = property->prop_id;
+            m_degammaSize = uint32_t(value);
             return;
         }
         if (property->name == QByteArrayLiteral("GAMMA_LUT_SIZE")) {
-            return;
-        }
-        if (property->name == QByteArrayLiteral("MODE_ID")) {
-            m_properties.modeId = property->prop_id;
-            return;
-        }
-        if (property->name == QByteArrayLiteral("rotation")) {
-            m_properties.rotation = property->prop_id;
+            m_gammaSize = uint32_t(value);
             return;
         }
     });
+
+    DrmScopedPointer<drmModeCrtc> crtc(device->getCrtc(id));
+    if (crtc && crtc->mode_valid)
+        m_mode = crtc->mode;
 }
 
 DrmCrtc::~DrmCrtc()
 {
+    if (m_outFence != -1)
+        close(m_outFence);
 }
 
 bool DrmCrtc::supports(Capability capability) const
 {
     switch (capability) {
+    case CapabilityDegamma:
+        return m_properties.degammaTable && m_degammaSize;
+    case CapabilityColorMatrix:
+        return m_properties.colorMatrix;
     case CapabilityGamma:
-        return m_properties.gammaTable && m_properties.degammaTable;
+        return m_properties.gammaTable && m_gammaSize;
     case CapabilityRotation:
         return m_properties.rotation;
+    case CapabilityVrr:
+        return m_properties.vrrEnabled;
     }
 
     Q_UNREACHABLE();
@@ -74,6 +87,31 @@ DrmMode DrmCrtc::mode() const
     return m_mode;
 }
 
+void DrmCrtc::setMode(const DrmMode& mode)
+{
+    m_mode = mode;
+}
+
+bool DrmCrtc::isActive() const
+{
+    return m_isActive;
+}
+
+void DrmCrtc::setActive(bool active)
+{
+    m_isActive = active;
+}
+
+uint32_t DrmCrtc::degammaSize() const
+{
+    return m_degammaSize;
+}
+
+uint32_t DrmCrtc::gammaSize() const
+{
+    return m_gammaSize;
+}
+
 DrmPlane* DrmCrtc::primaryPlane() const
 {
     return m_primaryPlane;
@@ -99,7 +137,24 @@ uint32_t DrmCrtc::pipe() const
     return m_pipe;
 }
 
-CrtcProperties DrmCrtc::properties() const
+const CrtcProperties& DrmCrtc::properties() const
 {
     return m_properties;
 }
+
+int32_t* DrmCrtc::outFenceStorage()
+{
+    // A fence nobody picked up belongs to a commit that has been dealt with.
+    if (m_outFence != -1)
+        close(m_outFence);
+    m_outFence = -1;
+
+    return &m_outFence;
+}
+
+int DrmCrtc::takeOutFence()
+{
+    const int fence = m_outFence;
+    m_outFence = -1;
+    return fence;
+}
@@ -29,7 +29,10 @@ struct CrtcProperties {
     // Optional properties, not all drivers provide them.
     uint32_t rotation = 0;
     uint32_t degammaTable = 0;
+    uint32_t colorMatrix = 0;
     uint32_t gammaTable = 0;
+    uint32_t outFencePtr = 0;
+    uint32_t vrrEnabled = 0;
 };
 
 class DrmCrtc : public DrmObject {
@@ -41,8 +44,11 @@ public:
      * This enum type is used to specify capabilities of CRTCs.
      */
     enum Capability {
+        CapabilityDegamma,
+        CapabilityColorMatrix,
         CapabilityGamma,
-        CapabilityRotation
+        CapabilityRotation,
+        CapabilityVrr
     };
 
     /**
@@ -56,10 +62,38 @@ public:
     uint32_t pipe() const;
 
     /**
-     * Returns the current display mode.
+     * Returns the display mode that the hardware currently uses. Initially,
+     * this is the mode that the firmware or the previous master has set. If
+     * the CRTC is off, an invalid mode is returned.
      */
     DrmMode mode() const;
 
+    /**
+     * Sets the current display mode, after a modeset has been committed.
+     */
+    void setMode(const DrmMode& mode);
+
+    /**
+     * Returns whether the CRTC is turned on. A CRTC that has been turned off
+     * with DPMS may still have a valid mode.
+     */
+    bool isActive() const;
+
+    /**
+     * Sets whether the CRTC is turned on, after a commit has changed it.
+     */
+    void setActive(bool active);
+
+    /**
+     * Returns the number of entries in the degamma table.
+     */
+    uint32_t degammaSize() const;
+
+    /**
+     * Returns the number of entries in the gamma table.
+     */
+    uint32_t gammaSize() const;
+
     /**
      * Returns the primary plane.
      */
@@ -83,9 +117,23 @@ public:
     void setCursorPlane(DrmPlane* plane);
 
     /**
+     * Returns ids of the properties of this CRTC.
+     */
+    const CrtcProperties& properties() const;
+
+    /**
+     * Returns where OUT_FENCE_PTR should point to.
      *
+     * The kernel writes the out-fence of a commit there. The storage belongs
+     * to the CRTC rather than to an output, so commits that are still in
+     * flight when an output goes away don't write to freed memory.
+     */
+    int32_t* outFenceStorage();
+
+    /**
+     * Takes the out-fence of the last commit. If there is none, -1 is returned.
      */
-    CrtcProperties properties() const;
+    int takeOutFence();
 
 private:
     CrtcProperties m_properties;
@@ -93,4 +141,8 @@ private:
     DrmPlane* m_primaryPlane = nullptr;
     DrmPlane* m_cursorPlane = nullptr;
     uint32_t m_pipe;
+    uint32_t m_degammaSize = 0;
+    uint32_t m_gammaSize = 0;
+    int32_t m_outFence = -1;
+    bool m_isActive = false;
 };
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DrmCursor.h"
+#include "DrmBuffer.h"
+#include "DrmCrtc.h"
+#include "DrmDevice.h"
+#include "DrmImage.h"
+#include "DrmOutput.h"
+#include "DrmPlane.h"
+#include "DrmSwapchain.h"
+
+#include <QVector>
+
+#include <drm_fourcc.h>
+
+DrmCursor::DrmCursor(DrmOutput* output)
+    : m_output(output)
+{
+}
+
+DrmCursor::~DrmCursor()
+{
+    // The images go back to the swapchain before it's destroyed, otherwise it
+    // would consider them in use and never hand them to the allocator.
+    for (DrmImage* image : { m_pendingImage, m_submittedImage, m_currentImage }) {
+        if (image)
+            image->release();
+    }
+}
+
+bool DrmCursor::isValid() const
+{
+    const DrmCrtc* crtc = m_output->crtc();
+    if (!crtc)
+        return false;
+
+    return crtc->cursorPlane();
+}
+
+QSize DrmCursor::size() const
+{
+    return m_output->device()->cursorSize();
+}
+
+DrmSwapchain* DrmCursor::swapchain()
+{
+    if (m_swapchain)
+        return m_swapchain.get();
+
+    const QSize size = this->size();
+    const uint32_t format = DRM_FORMAT_ARGB8888;
+
+    // Cursor planes can scan out only linear buffers on most hardware.
+    QVector<uint64_t> modifiers;
+    if (m_output->device()->supports(DrmDevice::DeviceCapabilityBufferModifier))
+        modifiers << DRM_FORMAT_MOD_LINEAR;
+
+    m_swapchain = std::make_unique<DrmSwapchain>(m_output->device(),
+        size.width(), size.height(), format, modifiers, 2);
+
+    return m_swapchain.get();
+}
+
+QPoint DrmCursor::position() const
+{
+    return m_position;
+}
+
+void DrmCursor::moveTo(const QPoint& position)
+{
+    if (m_position == position)
+        return;
+
+    m_position = position;
+    m_needsMove = true;
+
+    if (m_isVisible)
+        m_output->scheduleCursorUpdate();
+}
+
+QPoint DrmCursor::hotspot() const
+{
+    return m_hotspot;
+}
+
+bool DrmCursor::isVisible() const
+{
+    return m_isVisible;
+}
+
+void DrmCursor::setVisible(bool visible)
+{
+    if (m_isVisible == visible)
+        return;
+
+    m_isVisible = visible;
+    m_needsUpdate = true;
+
+    m_output->scheduleCursorUpdate();
+}
+
+void DrmCursor::update(DrmImage* image, const QPoint& hotspot)
+{
+    // The previous image hasn't been submitted yet, it's not needed anymore.
+    if (m_pendingImage)
+        m_pendingImage->release();
+
+    m_pendingImage = image;
+    m_hotspot = hotspot;
+    m_needsUpdate = true;
+
+    m_output->scheduleCursorUpdate();
+}
+
+bool DrmCursor::needsCommit() const
+{
+    if (!isValid())
+        return false;
+
+    return m_needsUpdate || (m_needsMove && m_isVisible);
+}
+
+void DrmCursor::addProperties(drmModeAtomicReq* request) const
+{
+    const DrmCrtc* crtc = m_output->crtc();
+    const DrmPlane* plane = crtc->cursorPlane();
+    const PlaneProperties& properties = plane->properties();
+    const uint32_t planeId = plane->id();
+
+    const DrmImage* image = m_pendingImage ? m_pendingImage : m_currentImage;
+    const DrmBuffer* buffer = image ? image->buffer() : nullptr;
+
+    // The plane position is signed, negative values are passed as is.
+    const QPoint topLeft = m_position - m_hotspot;
+    const uint64_t x = static_cast<int64_t>(topLeft.x());
+    const uint64_t y = static_cast<int64_t>(topLeft.y());
+
+    if (!m_needsUpdate) {
+        drmModeAtomicAddProperty(request, planeId, properties.crtcX, x);
+        drmModeAtomicAddProperty(request, planeId, properties.crtcY, y);
+        return;
+    }
+
+    if (!m_isVisible || !buffer) {
+        drmModeAtomicAddProperty(request, planeId, properties.crtcId, 0);
+        drmModeAtomicAddProperty(request, planeId, properties.frameBufferId, 0);
+        return;
+    }
+
+    drmModeAtomicAddProperty(request, planeId, properties.srcX, 0);
+    drmModeAtomicAddProperty(request, planeId, properties.srcY, 0);
+    drmModeAtomicAddProperty(request, planeId, properties.srcWidth, static_cast<uint64_t>(buffer->width()) << 16);
+    drmModeAtomicAddProperty(request, planeId, properties.srcHeight, static_cast<uint64_t>(buffer->height()) << 16);
+    drmModeAtomicAddProperty(request, planeId, properties.crtcX, x);
+    drmModeAtomicAddProperty(request, planeId, properties.crtcY, y);
+    drmModeAtomicAddProperty(request, planeId, properties.crtcWidth, buffer->width());
+    drmModeAtomicAddProperty(request, planeId, properties.crtcHeight, buffer->height());
+    drmModeAtomicAddProperty(request, planeId, properties.crtcId, crtc->id());
+    drmModeAtomicAddProperty(request, planeId, properties.frameBufferId, buffer->id());
+}
+
+void DrmCursor::commitSubmitted()
+{
+    if (m_pendingImage) {
+        m_submittedImage = m_pendingImage;
+        m_pendingImage = nullptr;
+    }
+
+    m_needsUpdate = false;
+    m_needsMove = false;
+}
+
+void DrmCursor::commitFailed()
+{
+    if (m_pendingImage) {
+        m_pendingImage->release();
+        m_pendingImage = nullptr;
+    }
+
+    // The position and the visibility are still wanted, they are sent again
+    // with the next commit.
+}
+
+void DrmCursor::pageFlipped()
+{
+    if (!m_submittedImage)
+        return;
+
+    if (m_currentImage)
+        m_currentImage->release();
+
+    m_currentImage = m_submittedImage;
+    m_submittedImage = nullptr;
+}
+
+void DrmCursor::invalidate()
+{
+    m_needsUpdate = true;
+}
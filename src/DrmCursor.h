@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "globals.h"
+
+#include <QPoint>
+#include <QSize>
+
+#include <xf86drmMode.h>
+
+#include <memory>
+
+class DrmCursor {
+public:
+    explicit DrmCursor(DrmOutput* output);
+    ~DrmCursor();
+
+    /**
+     * Returns whether the hardware cursor can be used on the output.
+     */
+    bool isValid() const;
+
+    /**
+     * Returns the size of cursor images.
+     */
+    QSize size() const;
+
+    /**
+     * Returns the swapchain that provides cursor images.
+     */
+    DrmSwapchain* swapchain();
+
+    /**
+     * Returns the position of the cursor hotspot, in output coordinates.
+     */
+    QPoint position() const;
+
+    /**
+     * Moves the cursor hotspot to the given @p position.
+     *
+     * Only the position of the cursor plane is updated, so moving the cursor
+     * never forces the scene to be rendered.
+     */
+    void moveTo(const QPoint& position);
+
+    /**
+     * Returns the hotspot of the cursor image.
+     */
+    QPoint hotspot() const;
+
+    /**
+     * Returns whether the cursor is visible.
+     */
+    bool isVisible() const;
+
+    /**
+     * Shows or hides the cursor.
+     */
+    void setVisible(bool visible);
+
+    /**
+     * Puts the given @p image on the cursor plane.
+     *
+     * The image must have been acquired from the swapchain of this cursor.
+     */
+    void update(DrmImage* image, const QPoint& hotspot);
+
+private:
+    bool needsCommit() const;
+    void addProperties(drmModeAtomicReq* request) const;
+    void commitSubmitted();
+    void commitFailed();
+    void pageFlipped();
+    void invalidate();
+
+    DrmOutput* m_output;
+    std::unique_ptr<DrmSwapchain> m_swapchain;
+    DrmImage* m_currentImage = nullptr;
+    DrmImage* m_submittedImage = nullptr;
+    DrmImage* m_pendingImage = nullptr;
+    QPoint m_position;
+    QPoint m_hotspot;
+    bool m_isVisible = false;
+    bool m_needsUpdate = false;
+    bool m_needsMove = false;
+
+    friend class DrmOutput;
+};
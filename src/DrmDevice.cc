@@ -17,77 +17,158 @@
  */
 
 #include "DrmDevice.h"
+#include "DrmBlob.h"
+#include "DrmBuffer.h"
+#include "DrmCommitThread.h"
 #include "DrmConnector.h"
 #include "DrmCrtc.h"
 #include "DrmDumbAllocator.h"
+#include "DrmFrameScheduler.h"
+#include "DrmFrameTimeline.h"
 #include "DrmGbmAllocator.h"
 #include "DrmImage.h"
+#include "DrmMemoryAllocator.h"
 #include "DrmOutput.h"
 #include "DrmOutputManager.h"
 #include "DrmPlane.h"
 #include "DrmPointer.h"
+#include "DrmProperty.h"
+#include "DrmSwapchain.h"
+#include "DrmVirtualDevice.h"
 #include "NativeContext.h"
+#include "NativeRenderer.h"
 #include "session/SessionController.h"
 
 #include <QBitArray>
 #include <QCoreApplication>
 #include <QSocketNotifier>
+#include <QTimer>
 
 #include <xf86drm.h>
 
-static uint64_t queryCapability(int fd, uint32_t capability)
-{
-    uint64_t value = 0;
+#include <algorithm>
 
-    if (drmGetCap(fd, capability, &value))
-        return 0;
+// How many blobs may be cached before unused ones are dropped.
+static const int maxCachedBlobs = 32;
 
-    return value;
-}
+static void handlePageFlip(DrmDevice* device, uint32_t crtcId, uint sequence,
+    const std::chrono::nanoseconds& timestamp);
 
 DrmDevice::DrmDevice(NativeContext* context, const QString& path, QObject* parent)
+    : DrmDevice(context, path, context->sessionController()->openRestricted(path), parent)
+{
+}
+
+DrmDevice::DrmDevice(NativeContext* context, const QString& path, int fd, QObject* parent)
     : QObject(parent)
     , m_context(context)
     , m_path(path)
+    , m_fd(fd)
 {
-    m_fd = m_context->sessionController()->openRestricted(path);
     if (m_fd == -1)
         return;
 
+    initialize();
+}
+
+DrmDevice::DrmDevice(NativeContext* context, DrmVirtualDevice* virtualDevice, QObject* parent)
+    : QObject(parent)
+    , m_context(context)
+    , m_virtualDevice(virtualDevice)
+    , m_path(QStringLiteral("virtual"))
+{
+    virtualDevice->setParent(this);
+    connect(virtualDevice, &DrmVirtualDevice::pageFlipped, this,
+        [this](uint32_t crtcId, uint sequence, std::chrono::nanoseconds timestamp) {
+            handlePageFlip(this, crtcId, sequence, timestamp);
+        });
+
+    initialize();
+}
+
+void DrmDevice::initialize()
+{
     // Check if this is actually a drm device.
-    DrmScopedPointer<drmModeRes> resources(drmModeGetResources(m_fd));
+    DrmScopedPointer<drmModeRes> resources(getResources());
     if (!resources)
         return;
 
-    m_supportsDumbBuffer = queryCapability(m_fd, DRM_CAP_DUMB_BUFFER);
-    m_supportsExportBuffer = queryCapability(m_fd, DRM_CAP_PRIME) & DRM_PRIME_CAP_EXPORT;
-    m_supportsImportBuffer = queryCapability(m_fd, DRM_CAP_PRIME) & DRM_PRIME_CAP_IMPORT;
-    m_supportsBufferModifier = queryCapability(m_fd, DRM_CAP_ADDFB2_MODIFIERS);
-
-    switch (m_context->allocatorType()) {
-    case AllocatorDumb:
-        m_allocator = new DrmDumbAllocator(this);
-        break;
-    case AllocatorGbm:
-        m_allocator = new DrmGbmAllocator(this);
-        break;
+    m_supportsDumbBuffer = queryCapability(DRM_CAP_DUMB_BUFFER);
+    m_supportsExportBuffer = queryCapability(DRM_CAP_PRIME) & DRM_PRIME_CAP_EXPORT;
+    m_supportsImportBuffer = queryCapability(DRM_CAP_PRIME) & DRM_PRIME_CAP_IMPORT;
+    m_supportsBufferModifier = queryCapability(DRM_CAP_ADDFB2_MODIFIERS);
+
+    m_cursorSize.setWidth(queryCapability(DRM_CAP_CURSOR_WIDTH));
+    m_cursorSize.setHeight(queryCapability(DRM_CAP_CURSOR_HEIGHT));
+    if (m_cursorSize.isEmpty())
+        m_cursorSize = QSize(64, 64);
+
+    if (m_virtualDevice) {
+        m_allocator = new DrmMemoryAllocator(this);
+    } else {
+        switch (m_context->allocatorType()) {
+        case AllocatorDumb:
+            m_allocator = new DrmDumbAllocator(this);
+            break;
+        case AllocatorGbm:
+            m_allocator = new DrmGbmAllocator(this);
+            break;
+        }
     }
 
     if (!m_allocator->isValid())
         return;
 
-    auto notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
-    connect(notifier, &QSocketNotifier::activated, this, &DrmDevice::dispatchEvents);
+    m_renderer = new NativeRenderer(this, this);
+    if (!m_renderer->isValid())
+        return;
+
+    if (!m_virtualDevice) {
+        // Commits and page flips are handled off the main thread, so that flip
+        // deadlines don't depend on how busy the event loop is.
+        auto commitThread = std::make_unique<DrmCommitThread>(m_fd, this);
+        if (commitThread->isValid()) {
+            m_commitThread = commitThread.release();
+            connect(m_commitThread, &DrmCommitThread::commitCompleted,
+                this, &DrmDevice::commitCompleted);
+            connect(m_commitThread, &DrmCommitThread::pageFlipped, this,
+                [this](uint32_t crtcId, uint sequence, std::chrono::nanoseconds timestamp) {
+                    handlePageFlip(this, crtcId, sequence, timestamp);
+                });
+        } else {
+            auto notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+            connect(notifier, &QSocketNotifier::activated, this, &DrmDevice::dispatchEvents);
+        }
+    }
 
     m_isValid = true;
 }
 
+uint64_t DrmDevice::queryCapability(uint64_t capability) const
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->capability(capability);
+
+    uint64_t value = 0;
+
+    if (drmGetCap(m_fd, capability, &value))
+        return 0;
+
+    return value;
+}
+
 DrmDevice::~DrmDevice()
 {
+    // The thread has to let go of the fd before it's closed.
+    delete m_commitThread;
+
+    qDeleteAll(m_removedOutputs);
     qDeleteAll(m_outputs);
     qDeleteAll(m_planes);
     qDeleteAll(m_crtcs);
     qDeleteAll(m_connectors);
+    qDeleteAll(m_properties);
+    m_blobs.clear();
 
     delete m_allocator;
 
@@ -113,6 +194,9 @@ bool DrmDevice::supports(DeviceCapability capability) const
 
 bool DrmDevice::enable(ClientCapability capability)
 {
+    if (m_virtualDevice)
+        return true;
+
     switch (capability) {
     case ClientCapabilityAtomic:
         return !drmSetClientCap(m_fd, DRM_CLIENT_CAP_ATOMIC, 1);
@@ -148,50 +232,45 @@ DrmAllocator* DrmDevice::allocator() const
     return m_allocator;
 }
 
-DrmConnectorList DrmDevice::connectors() const
+QSize DrmDevice::cursorSize() const
+{
+    return m_cursorSize;
+}
+
+const DrmConnectorList& DrmDevice::connectors() const
 {
     return m_connectors;
 }
 
 DrmConnector* DrmDevice::findConnector(uint32_t id) const
 {
-    for (DrmConnector* connector : m_connectors) {
-        if (connector->id() == id)
-            return connector;
-    }
-
-    return nullptr;
+    return m_connectorsById.value(id);
 }
 
-DrmCrtcList DrmDevice::crtcs() const
+const DrmCrtcList& DrmDevice::crtcs() const
 {
     return m_crtcs;
 }
 
 DrmCrtc* DrmDevice::findCrtc(uint32_t id) const
 {
-    for (DrmCrtc* crtc : m_crtcs) {
-        if (crtc->id() == id)
-            return crtc;
-    }
-
-    return nullptr;
+    return m_crtcsById.value(id);
 }
 
 DrmCrtcList DrmDevice::findCrtcs(uint32_t mask) const
 {
     DrmCrtcList crtcs;
 
-    for (DrmCrtc* crtc : m_crtcs) {
-        if (!(mask & (1 << crtc->pipe())))
-            continue;
-        crtcs << crtc;
+    // CRTCs are stored in the order of their pipes.
+    for (int pipe = 0; pipe < m_crtcs.count() && pipe < 32; ++pipe) {
+        if (mask & (1u << pipe))
+            crtcs << m_crtcs.at(pipe);
     }
 
     return crtcs;
 }
 
-DrmPlaneList DrmDevice::planes() const
+const DrmPlaneList& DrmDevice::planes() const
 {
     return m_planes;
 }
@@ -208,7 +287,221 @@ DrmPlaneList DrmDevice::planes(PlaneType type) const
     return planes;
 }
 
-DrmOutputList DrmDevice::outputs() const
+const DrmProperty* DrmDevice::findProperty(uint32_t id) const
+{
+    if (DrmProperty* property = m_properties.value(id))
+        return property;
+
+    m_propertyStatistics.propertyRequests++;
+
+    // Virtual devices go through the cache as well, so that the statistics
+    // tell what happens on real hardware.
+    if (m_virtualDevice) {
+        const DrmProperty* virtualProperty = m_virtualDevice->findProperty(id);
+        if (!virtualProperty)
+            return nullptr;
+
+        auto property = new DrmProperty(*virtualProperty);
+        m_properties.insert(id, property);
+        return property;
+    }
+
+    DrmScopedPointer<drmModePropertyRes> data(drmModeGetProperty(m_fd, id));
+    if (!data)
+        return nullptr;
+
+    auto property = new DrmProperty();
+    property->id = data->prop_id;
+    property->flags = data->flags;
+    property->name = data->name;
+
+    for (int i = 0; i < data->count_values; ++i)
+        property->values << data->values[i];
+    for (int i = 0; i < data->count_enums; ++i)
+        property->enums << data->enums[i];
+
+    m_properties.insert(id, property);
+
+    return property;
+}
+
+DrmPropertyStatistics DrmDevice::propertyStatistics() const
+{
+    return m_propertyStatistics;
+}
+
+bool DrmDevice::isVirtual() const
+{
+    return m_virtualDevice;
+}
+
+drmModeRes* DrmDevice::getResources() const
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->getResources();
+    return drmModeGetResources(m_fd);
+}
+
+drmModePlaneRes* DrmDevice::getPlaneResources() const
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->getPlaneResources();
+    return drmModeGetPlaneResources(m_fd);
+}
+
+drmModeConnector* DrmDevice::getConnector(uint32_t id) const
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->getConnector(id);
+    return drmModeGetConnector(m_fd, id);
+}
+
+drmModeConnector* DrmDevice::getConnectorCurrent(uint32_t id) const
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->getConnector(id);
+    return drmModeGetConnectorCurrent(m_fd, id);
+}
+
+drmModeEncoder* DrmDevice::getEncoder(uint32_t id) const
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->getEncoder(id);
+    return drmModeGetEncoder(m_fd, id);
+}
+
+drmModeCrtc* DrmDevice::getCrtc(uint32_t id) const
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->getCrtc(id);
+    return drmModeGetCrtc(m_fd, id);
+}
+
+drmModePlane* DrmDevice::getPlane(uint32_t id) const
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->getPlane(id);
+    return drmModeGetPlane(m_fd, id);
+}
+
+drmModeObjectProperties* DrmDevice::getObjectProperties(uint32_t id, uint32_t type) const
+{
+    drmModeObjectProperties* properties;
+    if (m_virtualDevice)
+        properties = m_virtualDevice->getObjectProperties(id, type);
+    else
+        properties = drmModeObjectGetProperties(m_fd, id, type);
+
+    m_propertyStatistics.objectRequests++;
+    if (properties)
+        m_propertyStatistics.listedProperties += properties->count_props;
+
+    return properties;
+}
+
+drmModePropertyBlobRes* DrmDevice::getPropertyBlob(uint32_t id) const
+{
+    // Virtual devices don't expose blobs, such as EDID or IN_FORMATS.
+    if (m_virtualDevice)
+        return nullptr;
+    return drmModeGetPropertyBlob(m_fd, id);
+}
+
+uint32_t DrmDevice::createPropertyBlob(const void* data, size_t size)
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->createPropertyBlob();
+
+    uint32_t id = 0;
+    if (drmModeCreatePropertyBlob(m_fd, data, size, &id))
+        return 0;
+
+    return id;
+}
+
+void DrmDevice::destroyPropertyBlob(uint32_t id)
+{
+    if (!m_virtualDevice)
+        drmModeDestroyPropertyBlob(m_fd, id);
+}
+
+std::shared_ptr<DrmBlob> DrmDevice::acquireBlob(const void* data, size_t size)
+{
+    // Looking up doesn't copy the contents, only inserting does.
+    const QByteArray key = QByteArray::fromRawData(static_cast<const char*>(data), int(size));
+
+    auto it = m_blobs.constFind(key);
+    if (it != m_blobs.constEnd())
+        return *it;
+
+    auto blob = std::make_shared<DrmBlob>(this, data, size);
+    if (!blob->isValid())
+        return blob;
+
+    // Drop blobs that nobody uses anymore once there are too many of them.
+    if (m_blobs.count() >= maxCachedBlobs) {
+        for (auto it = m_blobs.begin(); it != m_blobs.end();) {
+            if (it->use_count() == 1)
+                it = m_blobs.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    m_blobs.insert(QByteArray(static_cast<const char*>(data), int(size)), blob);
+
+    return blob;
+}
+
+uint32_t DrmDevice::addFramebuffer(uint32_t width, uint32_t height, uint32_t format,
+    const uint32_t* handles, const uint32_t* pitches, const uint32_t* offsets,
+    const uint64_t* modifiers)
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->addFramebuffer();
+
+    uint32_t id = 0;
+
+    if (modifiers) {
+        if (drmModeAddFB2WithModifiers(m_fd, width, height, format, handles, pitches,
+                offsets, modifiers, &id, DRM_MODE_FB_MODIFIERS))
+            return 0;
+    } else {
+        if (drmModeAddFB2(m_fd, width, height, format, handles, pitches, offsets, &id, 0))
+            return 0;
+    }
+
+    return id;
+}
+
+void DrmDevice::removeFramebuffer(uint32_t id)
+{
+    if (!m_virtualDevice)
+        drmModeRmFB(m_fd, id);
+}
+
+bool DrmDevice::commit(drmModeAtomicReq* request, uint32_t flags, const DrmCrtcList& crtcs,
+    void* userData)
+{
+    if (m_virtualDevice) {
+        QVector<uint32_t> crtcIds;
+        for (const DrmCrtc* crtc : crtcs)
+            crtcIds << crtc->id();
+        return m_virtualDevice->commit(flags, crtcIds);
+    }
+
+    return !drmModeAtomicCommit(m_fd, request, flags, userData);
+}
+
+bool DrmDevice::testRouting(drmModeAtomicReq* request)
+{
+    if (m_virtualDevice)
+        return m_virtualDevice->testRouting(request);
+
+    return commit(request, DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET);
+}
+
+const DrmOutputList& DrmDevice::outputs() const
 {
     return m_outputs;
 }
@@ -225,20 +518,16 @@ DrmOutput* DrmDevice::findOutput(const DrmConnector* connector) const
 
 DrmOutput* DrmDevice::findOutput(const DrmCrtc* crtc) const
 {
-    return findOutput(crtc->id());
+    return m_outputsByPipe.value(crtc->pipe());
 }
 
 DrmOutput* DrmDevice::findOutput(uint32_t crtcId) const
 {
-    for (DrmOutput* output : m_outputs) {
-        DrmCrtc* crtc = output->crtc();
-        if (!crtc)
-            continue;
-        if (crtc->id() == crtcId)
-            return output;
-    }
+    const DrmCrtc* crtc = m_crtcsById.value(crtcId);
+    if (!crtc)
+        return nullptr;
 
-    return nullptr;
+    return m_outputsByPipe.at(crtc->pipe());
 }
 
 NativeRenderer* DrmDevice::renderer() const
@@ -264,7 +553,7 @@ void DrmDevice::thaw()
 bool DrmDevice::isIdle() const
 {
     for (DrmOutput* output : m_outputs) {
-        if (output->pendingImage())
+        if (output->needsCommit() || output->isCommitPending())
             return false;
     }
 
@@ -281,6 +570,103 @@ void DrmDevice::waitIdle()
     thaw();
 }
 
+void DrmDevice::scheduleCommit()
+{
+    if (m_isCommitScheduled)
+        return;
+
+    m_isCommitScheduled = true;
+    QTimer::singleShot(0, this, &DrmDevice::commitPending);
+}
+
+void DrmDevice::commitPending()
+{
+    m_isCommitScheduled = false;
+
+    DrmOutputList outputs;
+    for (DrmOutput* output : m_outputs) {
+        // Outputs that still wait for a page flip will be picked up once it completes.
+        if (output->needsCommit() && !output->isCommitPending())
+            outputs << output;
+    }
+
+    // Released CRTCs are turned off even if no output needs a modeset, e.g.
+    // because all of them have kept the CRTCs that the firmware lit up.
+    const bool isRelease = !m_releasedCrtcs.isEmpty() && m_releasingCrtcs.isEmpty();
+
+    if (outputs.isEmpty() && !isRelease)
+        return;
+
+    if (m_commitRequest)
+        drmModeAtomicSetCursor(m_commitRequest.get(), 0);
+    else
+        m_commitRequest.reset(drmModeAtomicAlloc());
+
+    uint32_t flags = 0;
+    DrmCrtcList crtcs;
+    for (DrmOutput* output : outputs) {
+        drmModeAtomicMerge(m_commitRequest.get(), output->commitRequest());
+        flags |= output->commitFlags();
+        crtcs << output->crtc();
+    }
+
+    // Released CRTCs are turned off along with the modeset that has been
+    // tested with it, the new routing may depend on it.
+    if (isRelease) {
+        addReleaseProperties(m_commitRequest.get());
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+        crtcs << m_releasedCrtcs;
+        m_releasingCrtcs = m_releasedCrtcs;
+        m_releasedCrtcs.clear();
+    }
+
+    if (m_commitThread) {
+        queueCommit(m_commitRequest.get(), flags, outputs);
+        if (isRelease) {
+            if (m_queuedCommits.contains(m_commitSerial))
+                m_releaseSerial = m_commitSerial;
+            else
+                releaseCompleted(false);
+        }
+        return;
+    }
+
+    for (DrmOutput* output : outputs)
+        output->frameTimeline()->mark(DrmFrameStageCommitSubmit);
+
+    const bool committed = commit(m_commitRequest.get(), flags, crtcs, this);
+    for (DrmOutput* output : outputs)
+        output->frameTimeline()->mark(DrmFrameStageCommitReturn);
+
+    if (isRelease)
+        releaseCompleted(committed);
+
+    if (committed) {
+        for (DrmOutput* output : outputs)
+            output->commitSubmitted();
+        return;
+    }
+
+    if (outputs.count() == 1) {
+        outputs.first()->commitFailed();
+        return;
+    }
+
+    // Don't let a single misbehaving output stall the others, retry with
+    // separate commits so the outputs that can flip do flip.
+    for (DrmOutput* output : outputs) {
+        DrmFrameTimeline* timeline = output->frameTimeline();
+        timeline->mark(DrmFrameStageCommitSubmit);
+        const bool committed = commit(output->commitRequest(), output->commitFlags(),
+            { output->crtc() }, this);
+        timeline->mark(DrmFrameStageCommitReturn);
+        if (committed)
+            output->commitSubmitted();
+        else
+            output->commitFailed();
+    }
+}
+
 static std::chrono::nanoseconds makeTimestamp(uint tv_sec, uint tv_usec)
 {
     const auto seconds = std::chrono::seconds(tv_sec);
@@ -288,6 +674,31 @@ static std::chrono::nanoseconds makeTimestamp(uint tv_sec, uint tv_usec)
     return seconds + nanoseconds;
 }
 
+static void handlePageFlip(DrmDevice* device, uint32_t crtcId, uint sequence,
+    const std::chrono::nanoseconds& timestamp)
+{
+    DrmOutput* output = device->findOutput(crtcId);
+    if (!output)
+        return;
+
+    const bool isFramePresented = output->pageFlipped(sequence, timestamp);
+
+    // Some outputs may have been presented while their previous frame was
+    // still in flight, submit them now.
+    if (!device->isIdle())
+        device->scheduleCommit();
+
+    // Cursor updates don't count as presented frames.
+    if (!isFramePresented || device->isFrozen())
+        return;
+
+    const NativeContext* context = device->context();
+    if (!context->sessionController()->isActive())
+        return;
+
+    output->frameScheduler()->notifyFramePresented(sequence, timestamp);
+}
+
 static void deviceEventHandler(int,
     unsigned int sequence,
     unsigned int tv_sec,
@@ -296,26 +707,137 @@ static void deviceEventHandler(int,
     void* user_data)
 {
     DrmDevice* device = static_cast<DrmDevice*>(user_data);
+    handlePageFlip(device, crtc_id, sequence, makeTimestamp(tv_sec, tv_usec));
+}
 
-    DrmOutput* output = device->findOutput(crtc_id);
-    if (!output)
+void DrmDevice::queueCommit(drmModeAtomicReq* request, uint32_t flags, const DrmOutputList& outputs)
+{
+    const uint64_t serial = ++m_commitSerial;
+
+    if (!m_commitThread->submit(request, flags, serial)) {
+        for (DrmOutput* output : outputs)
+            output->commitFailed();
         return;
+    }
 
-    DrmImage* image = output->pendingImage();
-    image->release();
+    QVector<QPointer<DrmOutput>> queuedOutputs;
+    for (DrmOutput* output : outputs) {
+        output->commitQueued();
+        queuedOutputs << output;
+    }
 
-    output->setPendingImage(nullptr);
-    output->setSequence(sequence);
-    output->setTimestamp(makeTimestamp(tv_sec, tv_usec));
+    m_queuedCommits.insert(serial, queuedOutputs);
+}
 
-    if (device->isFrozen())
+static void addDisableProperties(drmModeAtomicReq* request, const DrmDevice* device,
+    const DrmCrtc* crtc)
+{
+    const CrtcProperties& crtcProperties = crtc->properties();
+    drmModeAtomicAddProperty(request, crtc->id(), crtcProperties.active, 0);
+    drmModeAtomicAddProperty(request, crtc->id(), crtcProperties.modeId, 0);
+
+    for (const DrmPlane* plane : device->planes()) {
+        const bool isSpecial = plane == crtc->primaryPlane() || plane == crtc->cursorPlane();
+        if (!isSpecial && plane->crtc() != crtc)
+            continue;
+
+        const PlaneProperties& planeProperties = plane->properties();
+        drmModeAtomicAddProperty(request, plane->id(), planeProperties.crtcId, 0);
+        drmModeAtomicAddProperty(request, plane->id(), planeProperties.frameBufferId, 0);
+    }
+}
+
+void DrmDevice::addReleaseProperties(drmModeAtomicReq* request) const
+{
+    for (const DrmCrtc* crtc : m_releasedCrtcs) {
+        addDisableProperties(request, this, crtc);
+
+        // Connectors that still hang off the CRTC have to let go of it too,
+        // e.g. one lit up by the firmware whose output is disabled. Rerouted
+        // outputs set the new CRTC of their connector themselves.
+        for (const DrmConnector* connector : m_connectors) {
+            const DrmOutput* output = findOutput(connector);
+            if (connector->crtc() == crtc && (!output || !output->crtc()))
+                drmModeAtomicAddProperty(request, connector->id(), connector->properties().crtcId, 0);
+        }
+    }
+}
+
+void DrmDevice::releaseCompleted(bool success)
+{
+    const DrmCrtcList crtcs = m_releasingCrtcs;
+    m_releasingCrtcs.clear();
+    m_releaseSerial = 0;
+
+    // The CRTCs are turned off with the next commit then, unless a new routing
+    // has picked them up in the meantime.
+    if (!success) {
+        for (DrmCrtc* crtc : crtcs) {
+            if (!findOutput(crtc) && !m_releasedCrtcs.contains(crtc))
+                m_releasedCrtcs << crtc;
+        }
         return;
+    }
 
-    const NativeContext* context = device->context();
-    if (!context->sessionController()->isActive())
+    // Remember what the hardware does now, so a later routing that picks up
+    // one of these CRTCs does a modeset.
+    for (DrmCrtc* crtc : crtcs) {
+        crtc->setActive(false);
+        crtc->setMode(DrmMode());
+
+        for (DrmConnector* connector : m_connectors) {
+            if (connector->crtc() == crtc)
+                connector->setCrtc(nullptr);
+        }
+
+        for (DrmPlane* plane : m_planes) {
+            const bool isSpecial = plane == crtc->primaryPlane() || plane == crtc->cursorPlane();
+            if (!isSpecial && plane->crtc() == crtc)
+                plane->setCrtc(nullptr);
+        }
+    }
+}
+
+void DrmDevice::commitCompleted(uint64_t serial, bool success,
+    std::chrono::nanoseconds submitTime, std::chrono::nanoseconds returnTime)
+{
+    if (DrmOutput* output = m_removedOutputs.take(serial)) {
+        if (success)
+            output->crtc()->setActive(false);
+        delete output;
         return;
+    }
+
+    DrmOutputList outputs;
+    for (DrmOutput* output : m_queuedCommits.take(serial)) {
+        // The output may have been removed in the meantime.
+        if (output)
+            outputs << output;
+    }
+
+    for (DrmOutput* output : outputs) {
+        DrmFrameTimeline* timeline = output->frameTimeline();
+        timeline->mark(DrmFrameStageCommitSubmit, submitTime);
+        timeline->mark(DrmFrameStageCommitReturn, returnTime);
+    }
+
+    if (serial == m_releaseSerial)
+        releaseCompleted(success);
+
+    if (success) {
+        for (DrmOutput* output : outputs)
+            output->commitSubmitted();
+        return;
+    }
+
+    if (outputs.count() == 1) {
+        outputs.first()->commitFailed();
+        return;
+    }
 
-    // TODO: Notify Compositor.
+    // Same as with synchronous commits, retry the outputs one by one.
+    for (DrmOutput* output : outputs)
+        queueCommit(output->commitRequest(), output->commitFlags(), { output });
 }
 
 void DrmDevice::dispatchEvents()
@@ -327,9 +849,64 @@ void DrmDevice::dispatchEvents()
     drmHandleEvent(m_fd, &context);
 }
 
+static bool isConnected(const DrmDevice* device, uint32_t connectorId)
+{
+    // The kernel has already probed the connector by the time a hotplug event
+    // arrives, reading the cached state doesn't touch the hardware.
+    DrmScopedPointer<drmModeConnector> connector(device->getConnectorCurrent(connectorId));
+    if (!connector)
+        return false;
+
+    return connector->connection == DRM_MODE_CONNECTED;
+}
+
+static uint32_t findEdidBlobId(const DrmDevice* device, uint32_t connectorId)
+{
+    DrmScopedPointer<drmModeObjectProperties> properties(
+        device->getObjectProperties(connectorId, DRM_MODE_OBJECT_CONNECTOR));
+    if (!properties)
+        return 0;
+
+    for (uint32_t i = 0; i < properties->count_props; ++i) {
+        const DrmProperty* property = device->findProperty(properties->props[i]);
+        if (property && property->name == QByteArrayLiteral("EDID"))
+            return uint32_t(properties->prop_values[i]);
+    }
+
+    return 0;
+}
+
+static bool isSameDisplay(const DrmDevice* device, const DrmConnector* connector)
+{
+    // A display swapped for another one on the same port may never show up as
+    // disconnected, but its EDID does change.
+    return findEdidBlobId(device, connector->id()) == connector->edidBlobId();
+}
+
 void DrmDevice::scanConnectors()
 {
-    DrmScopedPointer<drmModeRes> resources(drmModeGetResources(m_fd));
+    DrmScopedPointer<drmModeRes> resources(getResources());
+    if (!resources)
+        return;
+
+    // Nothing may have probed the connectors yet, so their cached state can't
+    // be trusted. Creating a connector probes it.
+    DrmConnectorList connectors;
+
+    for (int i = 0; i < resources->count_connectors; ++i) {
+        auto connector = std::make_unique<DrmConnector>(this, resources->connectors[i]);
+        if (!connector->isOnline())
+            continue;
+
+        connectors << connector.release();
+    }
+
+    updateConnectors(connectors);
+}
+
+void DrmDevice::rescanConnectors()
+{
+    DrmScopedPointer<drmModeRes> resources(getResources());
     if (!resources)
         return;
 
@@ -337,10 +914,14 @@ void DrmDevice::scanConnectors()
 
     for (int i = 0; i < resources->count_connectors; ++i) {
         const uint32_t connectorId = resources->connectors[i];
+        if (!isConnected(this, connectorId))
+            continue;
 
         if (DrmConnector* connector = findConnector(connectorId)) {
-            connectors << connector;
-            continue;
+            if (isSameDisplay(this, connector)) {
+                connectors << connector;
+                continue;
+            }
         }
 
         auto connector = std::make_unique<DrmConnector>(this, connectorId);
@@ -350,32 +931,144 @@ void DrmDevice::scanConnectors()
         connectors << connector.release();
     }
 
-    const DrmConnectorSet previousConnectors = m_connectors.toSet();
-    const DrmConnectorSet currentConnectors = connectors.toSet();
+    updateConnectors(connectors);
+}
+
+void DrmDevice::rescanConnector(uint32_t id)
+{
+    DrmConnectorList connectors = m_connectors;
+
+    const bool isOnline = isConnected(this, id);
+
+    if (DrmConnector* connector = findConnector(id)) {
+        if (isOnline && isSameDisplay(this, connector))
+            return;
+        connectors.removeOne(connector);
+    }
+
+    if (isOnline) {
+        auto connector = std::make_unique<DrmConnector>(this, id);
+        if (connector->isOnline())
+            connectors << connector.release();
+    }
+
+    updateConnectors(connectors);
+}
+
+static DrmConnectorSet toSet(const DrmConnectorList& connectors)
+{
+    DrmConnectorSet set;
+    set.reserve(connectors.count());
+
+    for (DrmConnector* connector : connectors)
+        set.insert(connector);
+
+    return set;
+}
+
+void DrmDevice::updateConnectors(const DrmConnectorList& connectors)
+{
+    const DrmConnectorSet previousConnectors = toSet(m_connectors);
+    const DrmConnectorSet currentConnectors = toSet(connectors);
+
     m_connectors = connectors;
+    m_connectorsById.clear();
+    for (DrmConnector* connector : m_connectors)
+        m_connectorsById.insert(connector->id(), connector);
 
     const DrmConnectorSet added = currentConnectors - previousConnectors;
     const DrmConnectorSet removed = previousConnectors - currentConnectors;
 
+    if (added.isEmpty() && removed.isEmpty())
+        return;
+
+    for (DrmConnector* connector : removed) {
+        if (DrmOutput* output = findOutput(connector))
+            removeOutput(output);
+        delete connector;
+    }
+
     for (DrmConnector* connector : added) {
         DrmOutput* output = new DrmOutput(connector, this);
         m_context->outputManager()->prepare(output);
         m_outputs << output;
     }
 
-    Q_UNUSED(removed)
-
     reroute();
 }
 
+void DrmDevice::removeOutput(DrmOutput* output)
+{
+    m_outputs.removeOne(output);
+    if (DrmCrtc* crtc = output->crtc())
+        m_outputsByPipe[crtc->pipe()] = nullptr;
+
+    if (DrmCrtc* crtc = output->crtc()) {
+        DrmScopedPointer<drmModeAtomicReq> request(drmModeAtomicAlloc());
+
+        const DrmConnector* connector = output->connector();
+        drmModeAtomicAddProperty(request.get(), connector->id(), connector->properties().crtcId, 0);
+
+        addDisableProperties(request.get(), this, crtc);
+
+        // The CRTC is turned off here, there is nothing left to release.
+        m_releasedCrtcs.removeOne(crtc);
+
+        for (DrmPlane* plane : m_planes) {
+            const bool isSpecial = plane == crtc->primaryPlane() || plane == crtc->cursorPlane();
+            if (!isSpecial && plane->crtc() == crtc)
+                plane->setCrtc(nullptr);
+        }
+
+        // Commits that are still queued on the commit thread may touch the
+        // CRTC, so the disable has to go after them. The output is kept until
+        // it has completed, its buffers can't be freed while they are still
+        // scanned out.
+        if (m_commitThread) {
+            const uint64_t serial = ++m_commitSerial;
+            if (m_commitThread->submit(request.get(), DRM_MODE_ATOMIC_ALLOW_MODESET, serial)) {
+                m_removedOutputs.insert(serial, output);
+                return;
+            }
+        }
+
+        // A blocking commit only waits for the frame in flight on this CRTC,
+        // other outputs keep flipping.
+        if (commit(request.get(), DRM_MODE_ATOMIC_ALLOW_MODESET, { crtc }))
+            crtc->setActive(false);
+    }
+
+    delete output;
+}
+
+void DrmDevice::setOutputCrtc(DrmOutput* output, DrmCrtc* crtc)
+{
+    if (const DrmCrtc* previousCrtc = output->crtc()) {
+        if (m_outputsByPipe.at(previousCrtc->pipe()) == output)
+            m_outputsByPipe[previousCrtc->pipe()] = nullptr;
+    }
+
+    output->setCrtc(crtc);
+
+    if (crtc)
+        m_outputsByPipe[crtc->pipe()] = output;
+}
+
 void DrmDevice::scanCrtcs()
 {
-    DrmScopedPointer<drmModeRes> resources(drmModeGetResources(m_fd));
+    DrmScopedPointer<drmModeRes> resources(getResources());
     if (!resources)
         return;
 
-    for (int i = 0; i < resources->count_crtcs; ++i)
-        m_crtcs << new DrmCrtc(this, resources->crtcs[i], i);
+    m_crtcs.reserve(resources->count_crtcs);
+
+    for (int i = 0; i < resources->count_crtcs; ++i) {
+        auto crtc = new DrmCrtc(this, resources->crtcs[i], i);
+        m_crtcs << crtc;
+        m_crtcsById.insert(crtc->id(), crtc);
+    }
+
+    m_outputsByPipe.fill(nullptr, m_crtcs.count());
 }
 
 static DrmPlane* findSpecialPlane(DrmCrtc* crtc, PlaneType type)
@@ -399,7 +1092,7 @@ static DrmPlane* findSpecialPlane(DrmCrtc* crtc, PlaneType type)
 
 void DrmDevice::scanPlanes()
 {
-    DrmScopedPointer<drmModePlaneRes> resources(drmModeGetPlaneResources(m_fd));
+    DrmScopedPointer<drmModePlaneRes> resources(getPlaneResources());
     if (!resources)
         return;
 
@@ -420,16 +1113,86 @@ void DrmDevice::scanPlanes()
 }
 
 struct MatchContext {
+    DrmDevice* device;
     DrmConnectorList connectors;
-    DrmCrtcList crtcs;
+    QVector<DrmCrtcList> candidates;
     DrmCrtcMap configuration;
     QBitArray taken;
 };
 
+static void addPrimaryPlane(drmModeAtomicReq* request, const DrmPlane* plane,
+    const DrmCrtc* crtc, const DrmBuffer* buffer)
+{
+    const PlaneProperties& properties = plane->properties();
+    const uint32_t planeId = plane->id();
+
+    if (!crtc || !buffer) {
+        drmModeAtomicAddProperty(request, planeId, properties.crtcId, 0);
+        drmModeAtomicAddProperty(request, planeId, properties.frameBufferId, 0);
+        return;
+    }
+
+    drmModeAtomicAddProperty(request, planeId, properties.srcX, 0);
+    drmModeAtomicAddProperty(request, planeId, properties.srcY, 0);
+    drmModeAtomicAddProperty(request, planeId, properties.srcWidth, static_cast<uint64_t>(buffer->width()) << 16);
+    drmModeAtomicAddProperty(request, planeId, properties.srcHeight, static_cast<uint64_t>(buffer->height()) << 16);
+    drmModeAtomicAddProperty(request, planeId, properties.crtcX, 0);
+    drmModeAtomicAddProperty(request, planeId, properties.crtcY, 0);
+    drmModeAtomicAddProperty(request, planeId, properties.crtcWidth, buffer->width());
+    drmModeAtomicAddProperty(request, planeId, properties.crtcHeight, buffer->height());
+    drmModeAtomicAddProperty(request, planeId, properties.crtcId, crtc->id());
+    drmModeAtomicAddProperty(request, planeId, properties.frameBufferId, buffer->id());
+}
+
+static const DrmBuffer* findTestBuffer(const DrmOutput* output)
+{
+    const DrmSwapchain* swapchain = output->swapchain();
+    if (!swapchain || !swapchain->isValid())
+        return nullptr;
+
+    const DrmImageList images = swapchain->images();
+    if (images.isEmpty())
+        return nullptr;
+
+    return images.first()->buffer();
+}
+
 static bool testConfiguration(const MatchContext& context)
 {
-    Q_UNUSED(context)
-    return true;
+    DrmDevice* device = context.device;
+
+    DrmScopedPointer<drmModeAtomicReq> request(drmModeAtomicAlloc());
+    if (!request)
+        return false;
+
+    for (DrmConnector* connector : device->connectors()) {
+        const DrmCrtc* crtc = context.configuration.value(connector);
+        const uint32_t crtcId = crtc ? crtc->id() : 0;
+        drmModeAtomicAddProperty(request.get(), connector->id(), connector->properties().crtcId, crtcId);
+    }
+
+    for (DrmCrtc* crtc : device->crtcs()) {
+        const CrtcProperties& properties = crtc->properties();
+        const DrmPlane* plane = crtc->primaryPlane();
+        const DrmConnector* connector = context.configuration.key(crtc);
+
+        // CRTCs that are left without a connector have to be turned off. The
+        // modeset that applies the routing does the same, see reroute().
+        if (!connector) {
+            if (crtc->isActive())
+                addDisableProperties(request.get(), device, crtc);
+            continue;
+        }
+
+        DrmOutput* output = device->findOutput(connector);
+
+        drmModeAtomicAddProperty(request.get(), crtc->id(), properties.active, 1);
+        drmModeAtomicAddProperty(request.get(), crtc->id(), properties.modeId, output->modeBlob()->id());
+        if (plane)
+            addPrimaryPlane(request.get(), plane, crtc, findTestBuffer(output));
+    }
+
+    return device->testRouting(request.get());
 }
 
 static bool findConfiguration(MatchContext& context, int depth = 0)
@@ -439,7 +1202,7 @@ static bool findConfiguration(MatchContext& context, int depth = 0)
 
     DrmConnector* connector = context.connectors.at(depth);
 
-    for (DrmCrtc* crtc : context.crtcs) {
+    for (DrmCrtc* crtc : context.candidates.at(depth)) {
         if (context.taken.testBit(crtc->pipe()))
             continue;
 
@@ -457,49 +1220,156 @@ static bool findConfiguration(MatchContext& context, int depth = 0)
     return false;
 }
 
-void DrmDevice::reroute()
+static QVector<uint32_t> makeRoutingKey(const DrmConnectorList& connectors)
 {
-    MatchContext context;
+    QVector<uint32_t> key;
+    key.reserve(connectors.count());
 
-    context.crtcs = m_crtcs;
-    context.taken.resize(m_crtcs.count());
+    for (const DrmConnector* connector : connectors)
+        key << connector->id();
+
+    std::sort(key.begin(), key.end());
+
+    return key;
+}
+
+static bool restoreConfiguration(MatchContext& context, const QVector<uint32_t>& routing)
+{
+    for (int i = 0; i + 1 < routing.count(); i += 2) {
+        DrmConnector* connector = context.device->findConnector(routing.at(i));
+        DrmCrtc* crtc = context.device->findCrtc(routing.at(i + 1));
+        if (!connector || !crtc)
+            return false;
+
+        context.configuration.insert(connector, crtc);
+    }
+
+    return testConfiguration(context);
+}
+
+bool DrmDevice::findRouting(DrmCrtcMap* routing)
+{
+    MatchContext context;
+    context.device = this;
 
     for (DrmOutput* output : m_outputs) {
         if (!output->isEnabled())
             continue;
         context.connectors << output->connector();
+
+        // Test commits need a frame buffer to put on the primary plane.
+        if (!output->swapchain())
+            output->createSwapchain();
     }
 
-    // Make sure that we prefer existing associations.
-    for (int i = 0; i < context.connectors.count(); ++i) {
-        const DrmConnector* connector = context.connectors[i];
-        if (!connector->crtc())
-            continue;
+    // Search the most constrained connectors first so that dead ends are
+    // discovered as early as possible.
+    std::stable_sort(context.connectors.begin(), context.connectors.end(),
+        [](const DrmConnector* a, const DrmConnector* b) {
+            return a->possibleCrtcs().count() < b->possibleCrtcs().count();
+        });
+
+    // Only CRTCs that the encoders can route to are worth testing, and we
+    // prefer existing associations to avoid needless modesets. A CRTC without
+    // a primary plane has nothing to show the swapchain on, outputs assume
+    // that there is one.
+    auto hasNoPrimaryPlane = [](const DrmCrtc* crtc) {
+        return !crtc->primaryPlane();
+    };
+    for (const DrmConnector* connector : context.connectors) {
+        DrmCrtcList candidates = connector->possibleCrtcs();
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(), hasNoPrimaryPlane),
+            candidates.end());
+        if (DrmCrtc* crtc = connector->crtc()) {
+            if (candidates.removeOne(crtc))
+                candidates.prepend(crtc);
+        }
+        context.candidates << candidates;
+    }
 
-        const int j = context.crtcs.indexOf(connector->crtc());
-        if (i == j)
-            continue;
+    context.taken.resize(m_crtcs.count());
+
+    const QVector<uint32_t> key = makeRoutingKey(context.connectors);
 
-        std::swap(context.crtcs[i], context.crtcs[j]);
+    bool found = false;
+    if (m_routingCache.contains(key)) {
+        found = restoreConfiguration(context, m_routingCache.value(key));
+        if (!found) {
+            m_routingCache.remove(key);
+            context.configuration.clear();
+        }
     }
 
-    if (!findConfiguration(context))
+    if (!found)
+        found = findConfiguration(context);
+
+    if (!found)
+        return false;
+
+    // Known good configurations are remembered as pairs of connector and CRTC ids.
+    QVector<uint32_t> cachedRouting;
+    for (DrmConnector* connector : context.connectors)
+        cachedRouting << connector->id() << context.configuration.value(connector)->id();
+    m_routingCache.insert(key, cachedRouting);
+
+    *routing = context.configuration;
+    return true;
+}
+
+void DrmDevice::clearRoutingCache()
+{
+    m_routingCache.clear();
+}
+
+void DrmDevice::reroute()
+{
+    DrmCrtcMap routing;
+    if (!findRouting(&routing))
         return;
 
-    for (DrmConnector* connector : context.connectors) {
-        DrmCrtc* crtc = context.configuration.value(connector);
+    // The tested configuration turns off CRTCs that are left without a
+    // connector, so the modeset that applies it has to do the same.
+    m_releasedCrtcs.clear();
+    for (DrmCrtc* crtc : m_crtcs) {
+        if (crtc->isActive() && !routing.key(crtc) && !m_releasingCrtcs.contains(crtc))
+            m_releasedCrtcs << crtc;
+    }
+
+    // Outputs that keep the CRTCs lit up by the firmware don't need a modeset,
+    // the CRTCs they don't use still have to be turned off.
+    if (!m_releasedCrtcs.isEmpty())
+        scheduleCommit();
+
+    DrmOutputList reroutedOutputs;
+
+    for (DrmOutput* currentOutput : m_outputs) {
+        DrmCrtc* crtc = routing.value(currentOutput->connector());
+        if (!crtc)
+            continue;
 
         DrmOutput* previousOutput = findOutput(crtc);
-        DrmOutput* currentOutput = findOutput(connector);
+
+        // Outputs that keep their CRTC carry on without a modeset.
+        if (currentOutput == previousOutput)
+            continue;
 
         if (previousOutput) {
-            previousOutput->destroySwapchain();
-            previousOutput->setCrtc(nullptr);
-            previousOutput->setNeedsModeset(true);
+            if (!routing.contains(previousOutput->connector()))
+                previousOutput->destroySwapchain();
+            setOutputCrtc(previousOutput, nullptr);
         }
 
-        currentOutput->setCrtc(crtc);
-        currentOutput->createSwapchain();
-        currentOutput->setNeedsModeset(true);
+        // Whether a modeset is needed is figured out by the output, which
+        // compares the new routing with what the hardware currently does.
+        setOutputCrtc(currentOutput, crtc);
+        if (!currentOutput->swapchain())
+            currentOutput->createSwapchain();
+        reroutedOutputs << currentOutput;
+    }
+
+    // The modeset is performed along with the first frame.
+    for (DrmOutput* output : reroutedOutputs) {
+        const DrmMode mode = output->desiredMode();
+        output->frameScheduler()->scheduleRepaint(QRect(0, 0, mode.width(), mode.height()));
     }
 }
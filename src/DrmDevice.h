@@ -20,16 +20,57 @@
 
 #include "globals.h"
 
+#include "DrmPointer.h"
+
+#include <QByteArray>
+#include <QHash>
 #include <QObject>
+#include <QPointer>
+#include <QSize>
+#include <QVector>
+
+#include <chrono>
+#include <memory>
 
+class DrmCommitThread;
 class NativeContext;
 class NativeRenderer;
 
+struct DrmPropertyStatistics {
+    /**
+     * The number of times the properties of an object have been requested.
+     */
+    uint64_t objectRequests = 0;
+
+    /**
+     * The number of properties listed by those requests. Without the cache,
+     * the metadata of each of them would be requested.
+     */
+    uint64_t listedProperties = 0;
+
+    /**
+     * The number of times the metadata of a property has been requested.
+     */
+    uint64_t propertyRequests = 0;
+};
+
 class DrmDevice : public QObject {
     Q_OBJECT
 
 public:
     DrmDevice(NativeContext* context, const QString& path, QObject* parent);
+
+    /**
+     * Creates a device for the given @p fd, which has already been opened by
+     * the session controller. The device takes ownership of the @p fd.
+     */
+    DrmDevice(NativeContext* context, const QString& path, int fd, QObject* parent);
+
+    /**
+     * Creates a device that runs on top of the given @p virtualDevice instead
+     * of real hardware. The device takes ownership of the @p virtualDevice.
+     */
+    DrmDevice(NativeContext* context, DrmVirtualDevice* virtualDevice, QObject* parent);
     ~DrmDevice() override;
 
     /**
@@ -108,10 +149,15 @@ public:
      */
     DrmAllocator* allocator() const;
 
+    /**
+     * Returns the size of hardware cursor images.
+     */
+    QSize cursorSize() const;
+
     /**
      * Returns the list of available connectors on this device.
      */
-    DrmConnectorList connectors() const;
+    const DrmConnectorList& connectors() const;
 
     /**
      * Returns a connector with the given id.
@@ -123,7 +169,7 @@ public:
     /**
      * Returns the list of available crtcs on this device.
      */
-    DrmCrtcList crtcs() const;
+    const DrmCrtcList& crtcs() const;
 
     /**
      * Returns a CRTC with the given id.
@@ -140,17 +186,97 @@ public:
     /**
      * Returns the list of available planes on this device.
      */
-    DrmPlaneList planes() const;
+    const DrmPlaneList& planes() const;
 
     /**
      * Returns all planes of the given type.
      */
     DrmPlaneList planes(PlaneType type) const;
 
+    /**
+     * Returns whether this device is simulated in memory.
+     */
+    bool isVirtual() const;
+
+    /**
+     * Kernel mode setting entry points.
+     *
+     * All objects talk to the kernel through these, so that a virtual device
+     * can stand in for the hardware. Returned structures are released with the
+     * usual libdrm functions.
+     */
+    drmModeRes* getResources() const;
+    drmModePlaneRes* getPlaneResources() const;
+    drmModeConnector* getConnector(uint32_t id) const;
+    drmModeConnector* getConnectorCurrent(uint32_t id) const;
+    drmModeEncoder* getEncoder(uint32_t id) const;
+    drmModeCrtc* getCrtc(uint32_t id) const;
+    drmModePlane* getPlane(uint32_t id) const;
+    drmModeObjectProperties* getObjectProperties(uint32_t id, uint32_t type) const;
+    drmModePropertyBlobRes* getPropertyBlob(uint32_t id) const;
+    uint32_t createPropertyBlob(const void* data, size_t size);
+    void destroyPropertyBlob(uint32_t id);
+    uint32_t addFramebuffer(uint32_t width, uint32_t height, uint32_t format,
+        const uint32_t* handles, const uint32_t* pitches, const uint32_t* offsets,
+        const uint64_t* modifiers);
+    void removeFramebuffer(uint32_t id);
+
+    /**
+     * Submits an atomic commit. The @p crtcs that the commit touches are only
+     * looked at by virtual devices, which can't peek into the request.
+     */
+    bool commit(drmModeAtomicReq* request, uint32_t flags,
+        const DrmCrtcList& crtcs = DrmCrtcList(), void* userData = nullptr);
+
+    /**
+     * Tests a modeset @p request that routes connectors to CRTCs.
+     */
+    bool testRouting(drmModeAtomicReq* request);
+
+    /**
+     * Finds CRTCs for the enabled outputs that the hardware accepts all at
+     * once, and stores them in @p routing.
+     *
+     * Routings that have been found before are tested first, see
+     * clearRoutingCache(). If there is no such routing, @c false is returned.
+     */
+    bool findRouting(DrmCrtcMap* routing);
+
+    /**
+     * Forgets the routings that have been found before, so the next search
+     * starts from scratch.
+     */
+    void clearRoutingCache();
+
+    /**
+     * Returns metadata of the property with the given id.
+     *
+     * Property ids are stable for the lifetime of the device, so the metadata
+     * is fetched only once. If there is no such property, @c null is returned.
+     */
+    const DrmProperty* findProperty(uint32_t id) const;
+
+    /**
+     * Returns how often property values and metadata have been requested from
+     * the kernel, or from the virtual device.
+     */
+    DrmPropertyStatistics propertyStatistics() const;
+
+    /**
+     * Returns a property blob with the given contents.
+     *
+     * Blobs are shared between all users that ask for the same contents, so
+     * e.g. outputs with identical modes don't create a kernel object each. A
+     * few blobs are kept around after their last user is gone, in case they
+     * are needed again. If the blob can't be created, an invalid one is
+     * returned.
+     */
+    std::shared_ptr<DrmBlob> acquireBlob(const void* data, size_t size);
+
     /**
      * Returns a list of outputs connected to this device.
      */
-    DrmOutputList outputs() const;
+    const DrmOutputList& outputs() const;
 
     /**
      * Returns an output with the given connector.
@@ -197,11 +323,32 @@ public:
      */
     void waitIdle();
 
+    /**
+     * Schedules an atomic commit.
+     *
+     * Pending state of all outputs that have been presented until control
+     * returns to the event loop is submitted in one atomic commit.
+     */
+    void scheduleCommit();
+
 private slots:
     void dispatchEvents();
+    void commitPending();
+    void commitCompleted(uint64_t serial, bool success,
+        std::chrono::nanoseconds submitTime, std::chrono::nanoseconds returnTime);
 
 private:
+    void initialize();
+    void queueCommit(drmModeAtomicReq* request, uint32_t flags, const DrmOutputList& outputs);
+    void addReleaseProperties(drmModeAtomicReq* request) const;
+    void releaseCompleted(bool success);
+    uint64_t queryCapability(uint64_t capability) const;
     void scanConnectors();
+    void rescanConnectors();
+    void rescanConnector(uint32_t id);
+    void updateConnectors(const DrmConnectorList& connectors);
+    void removeOutput(DrmOutput* output);
+    void setOutputCrtc(DrmOutput* output, DrmCrtc* crtc);
     void scanCrtcs();
     void scanPlanes();
     void reroute();
@@ -209,17 +356,46 @@ private:
     NativeContext* m_context;
     NativeRenderer* m_renderer = nullptr;
     DrmAllocator* m_allocator = nullptr;
+    DrmVirtualDevice* m_virtualDevice = nullptr;
+    DrmCommitThread* m_commitThread = nullptr;
     DrmConnectorList m_connectors;
     DrmCrtcList m_crtcs;
     DrmPlaneList m_planes;
     DrmOutputList m_outputs;
+
+    // CRTCs that have been left without a connector by reroute(), including
+    // ones lit by the firmware. They are turned off with the next commit, and
+    // are kept in m_releasingCrtcs until that commit has completed.
+    DrmCrtcList m_releasedCrtcs;
+    DrmCrtcList m_releasingCrtcs;
+
+    // Lookup tables for the page flip path. The outputs are indexed by the
+    // pipe of the CRTC that drives them.
+    QHash<uint32_t, DrmConnector*> m_connectorsById;
+    QHash<uint32_t, DrmCrtc*> m_crtcsById;
+    DrmOutputList m_outputsByPipe;
+
+    DrmScopedPointer<drmModeAtomicReq> m_commitRequest;
+    QHash<QVector<uint32_t>, QVector<uint32_t>> m_routingCache;
+    mutable QHash<uint32_t, DrmProperty*> m_properties;
+    mutable DrmPropertyStatistics m_propertyStatistics;
+    QHash<QByteArray, std::shared_ptr<DrmBlob>> m_blobs;
+    QHash<uint64_t, QVector<QPointer<DrmOutput>>> m_queuedCommits;
+
+    // Removed outputs that are kept until the commit that turns off their CRTC
+    // has completed, keyed by the serial of that commit.
+    QHash<uint64_t, DrmOutput*> m_removedOutputs;
+    uint64_t m_commitSerial = 0;
+    uint64_t m_releaseSerial = 0;
     QString m_path;
+    QSize m_cursorSize;
     int m_fd = -1;
     int m_freezeCounter = 0;
     bool m_supportsDumbBuffer = false;
     bool m_supportsExportBuffer = false;
     bool m_supportsImportBuffer = false;
     bool m_supportsBufferModifier = false;
+    bool m_isCommitScheduled = false;
     bool m_isValid = false;
 
     friend class DrmDeviceManager;
@@ -18,6 +18,10 @@
 
 #include "DrmDeviceManager.h"
 #include "DrmDevice.h"
+#include "DrmFrameScheduler.h"
+#include "DrmOutput.h"
+#include "DrmProperty.h"
+#include "DrmVirtualDevice.h"
 #include "NativeContext.h"
 #include "session/SessionController.h"
 #include "udev/UdevContext.h"
@@ -25,19 +29,194 @@
 #include "udev/UdevEnumerator.h"
 #include "udev/UdevMonitor.h"
 
+#include <QPointer>
+
+#include <cstdio>
 #include <memory>
 
+#include <sys/stat.h>
+
+static bool parseVirtualMode(QSize* resolution, uint32_t* refreshRate)
+{
+    // DRM_PLAYGROUND_VIRTUAL_MODE has the form WIDTHxHEIGHT@HZ, e.g. 1920x1080@60.
+    const QByteArray mode = qgetenv("DRM_PLAYGROUND_VIRTUAL_MODE");
+    if (mode.isEmpty())
+        return true;
+
+    int width = 0;
+    int height = 0;
+    double refresh = 0;
+    if (sscanf(mode.constData(), "%dx%d@%lf", &width, &height, &refresh) != 3)
+        return false;
+    if (width <= 0 || height <= 0 || refresh <= 0)
+        return false;
+
+    *resolution = QSize(width, height);
+    *refreshRate = uint32_t(refresh * 1000);
+
+    return true;
+}
+
 DrmDeviceManager::DrmDeviceManager(NativeContext* context, QObject* parent)
     : QObject(parent)
     , m_context(context)
 {
+    // DRM_PLAYGROUND_VIRTUAL_OUTPUTS replaces the GPUs with simulated ones.
+    const int virtualOutputCount = qgetenv("DRM_PLAYGROUND_VIRTUAL_OUTPUTS").toInt();
+    if (virtualOutputCount > 0) {
+        createVirtualDevices(virtualOutputCount);
+        m_isReady = true;
+        return;
+    }
+
     UdevEnumerator enumerator(*context->udev());
     enumerator.matchSeat(context->sessionController()->seat());
     enumerator.matchSubsystem(QStringLiteral("drm"));
     enumerator.matchSysfsName(QStringLiteral("card[0-9]*"));
 
-    const QVector<UdevDevice> devices = enumerator.scan();
+    openDevices(enumerator.scan());
+}
+
+DrmDeviceManager::~DrmDeviceManager()
+{
+    // Startup may still wait for some of the devices.
+    for (int fd : m_startupFds) {
+        if (fd != -1)
+            m_context->sessionController()->closeRestricted(fd);
+    }
+
+    for (DrmDevice* device : m_devices)
+        device->freeze();
+
+    for (DrmDevice* device : m_devices)
+        device->waitIdle();
+
+    qDeleteAll(m_devices);
+}
+
+void DrmDeviceManager::createVirtualDevices(int outputCount)
+{
+    QSize resolution(1920, 1080);
+    uint32_t refreshRate = 60000;
+    if (!parseVirtualMode(&resolution, &refreshRate))
+        return;
+
+    // A device can't have more CRTCs than fit in a possible_crtcs mask, larger
+    // setups are spread over several devices.
+    while (outputCount > 0) {
+        const int count = qMin(outputCount, DrmVirtualDevice::maxOutputCount);
+        outputCount -= count;
+
+        // The device owns the virtual device from here on, also if it turns
+        // out to be invalid.
+        auto virtualDevice = std::make_unique<DrmVirtualDevice>(count, resolution, refreshRate);
+        auto dev = std::make_unique<DrmDevice>(m_context, virtualDevice.release(), this);
+        if (!dev->isValid())
+            break;
+
+        dev->scanCrtcs();
+        dev->scanPlanes();
+        dev->scanConnectors();
+
+        m_devices << dev.release();
+    }
+
+    if (!m_devices.isEmpty())
+        m_primaryDevice = m_devices.first();
+}
+
+bool DrmDeviceManager::isReady() const
+{
+    return m_isReady;
+}
+
+bool DrmDeviceManager::isValid() const
+{
+    return m_primaryDevice;
+}
+
+const DrmDeviceList& DrmDeviceManager::devices() const
+{
+    return m_devices;
+}
+
+DrmDevice* DrmDeviceManager::primaryDevice() const
+{
+    return m_primaryDevice;
+}
+
+static bool isGpu(const UdevDevice& device)
+{
+    if (!(device.types() & UdevDevice::Gpu))
+        return false;
+
+    return !device.deviceNode().isEmpty();
+}
+
+void DrmDeviceManager::openDevices(const QVector<UdevDevice>& devices)
+{
+    m_startupDevices = devices;
+    m_startupFds = QVector<int>(devices.count(), -1);
+
     for (const UdevDevice& device : devices) {
+        if (isGpu(device))
+            m_pendingOpenCount++;
+    }
+
+    if (!m_pendingOpenCount) {
+        initialize();
+        return;
+    }
+
+    // All devices are taken at once, so startup pays for a single round trip
+    // to the session controller no matter how many GPUs there are. The event
+    // loop keeps running until the replies arrive.
+    QPointer<DrmDeviceManager> guard(this);
+    SessionController* sessionController = m_context->sessionController();
+
+    for (int i = 0; i < devices.count(); ++i) {
+        if (!isGpu(devices.at(i)))
+            continue;
+
+        sessionController->openRestrictedAsync(devices.at(i).deviceNode(), [=](int fd) {
+            if (guard)
+                guard->deviceOpened(i, fd);
+            else if (fd != -1)
+                sessionController->closeRestricted(fd);
+        });
+    }
+}
+
+void DrmDeviceManager::deviceOpened(int index, int fd)
+{
+    m_startupFds[index] = fd;
+
+    if (--m_pendingOpenCount)
+        return;
+
+    initialize();
+}
+
+void DrmDeviceManager::initialize()
+{
+    const QVector<UdevDevice> devices = m_startupDevices;
+    const QVector<int> fds = m_startupFds;
+
+    m_startupDevices.clear();
+    m_startupFds.clear();
+
+    setUpDevices(devices, fds);
+
+    m_isReady = true;
+    emit ready();
+}
+
+void DrmDeviceManager::setUpDevices(const QVector<UdevDevice>& devices, const QVector<int>& fds)
+{
+    SessionController* sessionController = m_context->sessionController();
+
+    for (int i = 0; i < devices.count(); ++i) {
+        const UdevDevice& device = devices.at(i);
         if (!(device.types() & UdevDevice::PrimaryGpu))
             continue;
 
@@ -45,12 +224,12 @@ DrmDeviceManager::DrmDeviceManager(NativeContext* context, QObject* parent)
         if (path.isEmpty())
             continue;
 
-        auto dev = std::make_unique<DrmDevice>(m_context, path, this);
+        auto dev = std::make_unique<DrmDevice>(m_context, path, fds.at(i), this);
         if (!dev->isValid())
             continue;
 
         if (!dev->enable(DrmDevice::ClientCapabilityUniversalPlanes))
-            return;
+            continue;
 
         if (!dev->enable(DrmDevice::ClientCapabilityAtomic))
             continue;
@@ -62,62 +241,62 @@ DrmDeviceManager::DrmDeviceManager(NativeContext* context, QObject* parent)
         m_devices << dev.release();
     }
 
-    if (m_devices.isEmpty())
+    if (m_devices.isEmpty()) {
+        // Secondary GPUs are of no use without a primary one.
+        for (int i = 0; i < devices.count(); ++i) {
+            if (fds.at(i) != -1 && !(devices.at(i).types() & UdevDevice::PrimaryGpu))
+                sessionController->closeRestricted(fds.at(i));
+        }
         return;
+    }
 
     m_primaryDevice = m_devices.last();
 
-    for (const UdevDevice& device : devices)
-        add(device);
+    for (int i = 0; i < devices.count(); ++i) {
+        const UdevDevice& device = devices.at(i);
+        if (device.types() & UdevDevice::PrimaryGpu)
+            continue;
+        add(device, fds.at(i));
+    }
 
-    m_monitor = new UdevMonitor(context->udev(), this);
+    connect(sessionController, &SessionController::devicePaused, this, &DrmDeviceManager::pause);
+    connect(sessionController, &SessionController::deviceResumed, this, &DrmDeviceManager::resume);
+
+    m_monitor = new UdevMonitor(m_context->udev(), this);
     m_monitor->filterBySubsystem(QStringLiteral("drm"));
     m_monitor->enable();
 
-    connect(m_monitor, &UdevMonitor::deviceAdded, this, &DrmDeviceManager::add);
+    connect(m_monitor, &UdevMonitor::deviceAdded, this, [this](const UdevDevice& device) {
+        add(device);
+    });
     connect(m_monitor, &UdevMonitor::deviceRemoved, this, &DrmDeviceManager::remove);
     connect(m_monitor, &UdevMonitor::deviceChanged, this, &DrmDeviceManager::reload);
 }
 
-DrmDeviceManager::~DrmDeviceManager()
-{
-    for (DrmDevice* device : m_devices)
-        device->freeze();
-
-    for (DrmDevice* device : m_devices)
-        device->waitIdle();
-
-    qDeleteAll(m_devices);
-}
-
-bool DrmDeviceManager::isValid() const
-{
-    return m_primaryDevice;
-}
-
-DrmDeviceList DrmDeviceManager::devices() const
-{
-    return m_devices;
-}
-
-DrmDevice* DrmDeviceManager::primaryDevice() const
-{
-    return m_primaryDevice;
-}
-
 void DrmDeviceManager::add(const UdevDevice& device)
 {
-    if (!(device.types() & UdevDevice::Gpu))
+    if (!isGpu(device))
         return;
 
     if (device.types() & UdevDevice::PrimaryGpu)
         return;
 
-    const QString path = device.deviceNode();
-    if (path.isEmpty())
+    QPointer<DrmDeviceManager> guard(this);
+    SessionController* sessionController = m_context->sessionController();
+    sessionController->openRestrictedAsync(device.deviceNode(), [=](int fd) {
+        if (guard)
+            guard->add(device, fd);
+        else if (fd != -1)
+            sessionController->closeRestricted(fd);
+    });
+}
+
+void DrmDeviceManager::add(const UdevDevice& device, int fd)
+{
+    if (fd == -1)
         return;
 
-    auto dev = std::make_unique<DrmDevice>(m_context, path, this);
+    auto dev = std::make_unique<DrmDevice>(m_context, device.deviceNode(), fd, this);
     if (!dev->isValid())
         return;
 
@@ -161,8 +340,69 @@ void DrmDeviceManager::reload(const UdevDevice& device)
     if (!dev)
         return;
 
-    dev->waitIdle();
-    dev->scanConnectors();
+    // Recent kernels tell which connector has changed, so the other outputs
+    // don't have to be disturbed at all.
+    bool isConnectorId = false;
+    const uint32_t connectorId = device.property(QStringLiteral("CONNECTOR")).toUInt(&isConnectorId);
+    if (isConnectorId) {
+        // Events about a single property, such as the content protection
+        // state, don't change which display is connected.
+        bool isPropertyId = false;
+        const uint32_t propertyId = device.property(QStringLiteral("PROPERTY")).toUInt(&isPropertyId);
+        if (isPropertyId) {
+            const DrmProperty* property = dev->findProperty(propertyId);
+            if (!property || property->name != QByteArrayLiteral("EDID"))
+                return;
+        }
+
+        dev->rescanConnector(connectorId);
+        return;
+    }
+
+    dev->rescanConnectors();
+}
+
+void DrmDeviceManager::pause(dev_t device)
+{
+    DrmDevice* dev = findDevice(device);
+    if (!dev || m_pausedDevices.contains(dev))
+        return;
+
+    m_pausedDevices << dev;
+    dev->freeze();
+}
+
+void DrmDeviceManager::resume(dev_t device)
+{
+    DrmDevice* dev = findDevice(device);
+    if (!dev || !m_pausedDevices.remove(dev))
+        return;
+
+    dev->thaw();
+
+    // Someone else had the device in the meantime, so the state of the
+    // hardware is unknown.
+    for (DrmOutput* output : dev->outputs()) {
+        if (!output->crtc())
+            continue;
+        output->setNeedsModeset(true);
+
+        const DrmMode mode = output->desiredMode();
+        output->frameScheduler()->scheduleRepaint(QRect(0, 0, mode.width(), mode.height()));
+    }
+}
+
+DrmDevice* DrmDeviceManager::findDevice(dev_t device)
+{
+    for (DrmDevice* dev : m_devices) {
+        struct stat st;
+        if (fstat(dev->fd(), &st) < 0)
+            continue;
+        if (st.st_rdev == device)
+            return dev;
+    }
+
+    return nullptr;
 }
 
 DrmDevice* DrmDeviceManager::findDevice(const UdevDevice& udev)
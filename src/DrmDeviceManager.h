@@ -20,10 +20,15 @@
 
 #include "globals.h"
 
+#include "udev/UdevDevice.h"
+
 #include <QObject>
+#include <QSet>
+#include <QVector>
+
+#include <sys/types.h>
 
 class NativeContext;
-class UdevDevice;
 class UdevMonitor;
 
 class DrmDeviceManager : public QObject {
@@ -33,6 +38,14 @@ public:
     explicit DrmDeviceManager(NativeContext* context, QObject* parent = nullptr);
     ~DrmDeviceManager() override;
 
+    /**
+     * Whether the devices that were present at startup have been opened.
+     *
+     * Devices are opened without blocking, the ready() signal is emitted once
+     * this is done, unless it's done by the time the constructor returns.
+     */
+    bool isReady() const;
+
     /**
      * Whether this device manager is valid, i.e. there is a primary device.
      */
@@ -41,23 +54,44 @@ public:
     /**
      * Returns all devices on this platform.
      */
-    DrmDeviceList devices() const;
+    const DrmDeviceList& devices() const;
 
     /**
      * Returns the primary device.
      */
     DrmDevice* primaryDevice() const;
 
+signals:
+    /**
+     * This signal is emitted when the devices that were present at startup
+     * have been opened. Whether a primary device was found is told by isValid().
+     */
+    void ready();
+
 private:
+    void createVirtualDevices(int outputCount);
+    void openDevices(const QVector<UdevDevice>& devices);
+    void deviceOpened(int index, int fd);
+    void initialize();
+    void setUpDevices(const QVector<UdevDevice>& devices, const QVector<int>& fds);
     void add(const UdevDevice& device);
+    void add(const UdevDevice& device, int fd);
     void remove(const UdevDevice& device);
     void reload(const UdevDevice& device);
+    void pause(dev_t device);
+    void resume(dev_t device);
+    DrmDevice* findDevice(dev_t device);
     DrmDevice* findDevice(const UdevDevice& device);
 
     NativeContext* m_context;
     UdevMonitor* m_monitor = nullptr;
     DrmDeviceList m_devices;
     DrmDevice* m_primaryDevice = nullptr;
+    QSet<DrmDevice*> m_pausedDevices;
+    QVector<UdevDevice> m_startupDevices;
+    QVector<int> m_startupFds;
+    int m_pendingOpenCount = 0;
+    bool m_isReady = false;
 
     Q_DISABLE_COPY(DrmDeviceManager)
 };
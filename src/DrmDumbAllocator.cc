@@ -20,6 +20,12 @@
 #include "DrmDevice.h"
 #include "DrmDumbImage.h"
 
+#include <QVector>
+
+#include <drm_fourcc.h>
+
+#include <memory>
+
 DrmDumbAllocator::DrmDumbAllocator(DrmDevice* device, QObject* parent)
     : DrmAllocator(parent)
     , m_device(device)
@@ -36,12 +42,22 @@ bool DrmDumbAllocator::isValid() const
     return m_isValid;
 }
 
+QVector<uint64_t> DrmDumbAllocator::modifiers(uint32_t format) const
+{
+    Q_UNUSED(format)
+    return { DRM_FORMAT_MOD_LINEAR };
+}
+
 DrmImage* DrmDumbAllocator::allocate(uint32_t width, uint32_t height, uint32_t format,
     const QVector<uint64_t>& modifiers)
 {
-    Q_UNUSED(width)
-    Q_UNUSED(height)
-    Q_UNUSED(format)
-    Q_UNUSED(modifiers)
-    return nullptr;
+    // Dumb buffers are always linear.
+    if (!modifiers.isEmpty() && !modifiers.contains(DRM_FORMAT_MOD_LINEAR))
+        return nullptr;
+
+    auto image = std::make_unique<DrmDumbImage>(m_device, width, height, format);
+    if (!image->isValid())
+        return nullptr;
+
+    return image.release();
 }
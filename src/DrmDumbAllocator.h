@@ -28,6 +28,7 @@ public:
     ~DrmDumbAllocator() override;
 
     bool isValid() const override;
+    QVector<uint64_t> modifiers(uint32_t format) const override;
     DrmImage* allocate(uint32_t width, uint32_t height, uint32_t format,
         const QVector<uint64_t>& modifiers) override;
 
@@ -18,12 +18,108 @@
 
 #include "DrmDumbImage.h"
 #include "DrmBuffer.h"
+#include "DrmDevice.h"
+
+#include <drm_fourcc.h>
+#include <xf86drm.h>
+
+#include <sys/mman.h>
+
+static uint32_t bitsPerPixel(uint32_t format)
+{
+    switch (format) {
+    case DRM_FORMAT_RGB565:
+    case DRM_FORMAT_BGR565:
+        return 16;
+    case DRM_FORMAT_RGB888:
+    case DRM_FORMAT_BGR888:
+        return 24;
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_RGBX8888:
+    case DRM_FORMAT_BGRX8888:
+    case DRM_FORMAT_ARGB8888:
+    case DRM_FORMAT_ABGR8888:
+    case DRM_FORMAT_RGBA8888:
+    case DRM_FORMAT_BGRA8888:
+    case DRM_FORMAT_XRGB2101010:
+    case DRM_FORMAT_XBGR2101010:
+    case DRM_FORMAT_ARGB2101010:
+    case DRM_FORMAT_ABGR2101010:
+        return 32;
+    default:
+        return 0;
+    }
+}
+
+DrmDumbImage::DrmDumbImage(DrmDevice* device, uint32_t width, uint32_t height, uint32_t format)
+    : m_device(device)
+{
+    const int fd = device->fd();
+
+    const uint32_t bpp = bitsPerPixel(format);
+    if (!bpp)
+        return;
+
+    drm_mode_create_dumb createArgs = {};
+    createArgs.width = width;
+    createArgs.height = height;
+    createArgs.bpp = bpp;
+    if (drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &createArgs))
+        return;
+
+    m_handle = createArgs.handle;
+    m_stride = createArgs.pitch;
+    m_size = createArgs.size;
+
+    drm_mode_map_dumb mapArgs = {};
+    mapArgs.handle = m_handle;
+    if (drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mapArgs))
+        return;
+
+    void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mapArgs.offset);
+    if (data == MAP_FAILED)
+        return;
+
+    m_data = data;
+
+    const std::array<uint32_t, 4> handles = { m_handle };
+    const std::array<uint32_t, 4> strides = { m_stride };
+    const std::array<uint32_t, 4> offsets = { 0 };
+
+    m_buffer = DrmBuffer::create(device, width, height, format, handles, strides, offsets);
+}
 
 DrmDumbImage::~DrmDumbImage()
 {
+    delete m_buffer;
+
+    if (m_data)
+        munmap(m_data, m_size);
+
+    if (m_handle) {
+        drm_mode_destroy_dumb destroyArgs = {};
+        destroyArgs.handle = m_handle;
+        drmIoctl(m_device->fd(), DRM_IOCTL_MODE_DESTROY_DUMB, &destroyArgs);
+    }
 }
 
 DrmBuffer* DrmDumbImage::buffer() const
 {
     return m_buffer;
 }
+
+void* DrmDumbImage::data() const
+{
+    return m_data;
+}
+
+uint32_t DrmDumbImage::stride() const
+{
+    return m_stride;
+}
+
+size_t DrmDumbImage::size() const
+{
+    return m_size;
+}
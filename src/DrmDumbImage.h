@@ -1,4 +1,3 @@
-
 /*
  * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
  *
@@ -21,14 +20,35 @@
 
 #include "DrmImage.h"
 
+#include <cstddef>
+#include <cstdint>
+
 class DrmDumbImage : public DrmImage {
 public:
+    DrmDumbImage(DrmDevice* device, uint32_t width, uint32_t height, uint32_t format);
     ~DrmDumbImage() override;
 
     DrmBuffer* buffer() const override;
 
+    /**
+     * The image is mapped once for its whole lifetime, so the returned pointer
+     * can be written to directly.
+     */
+    void* data() const override;
+    uint32_t stride() const override;
+
+    /**
+     * Returns the size of the mapping, in bytes.
+     */
+    size_t size() const;
+
 private:
+    DrmDevice* m_device;
     DrmBuffer* m_buffer = nullptr;
+    void* m_data = nullptr;
+    size_t m_size = 0;
+    uint32_t m_handle = 0;
+    uint32_t m_stride = 0;
 
     Q_DISABLE_COPY(DrmDumbImage)
 };
@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DrmFrameScheduler.h"
+#include "DrmConnector.h"
+#include "DrmDevice.h"
+#include "DrmFrameTimeline.h"
+#include "DrmOutput.h"
+#include "NativeContext.h"
+#include "EDID.h"
+#include "NativeRenderer.h"
+#include "session/SessionController.h"
+
+#include <QSocketNotifier>
+
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// Used when the refresh rate of the output is unknown.
+static const std::chrono::nanoseconds s_defaultRefreshInterval(16666667);
+
+// How many flips are needed before the measured refresh interval is trusted.
+static const int s_minEstimateSamples = 8;
+
+// Flips further apart than this many vblanks are not used for the estimate,
+// the output was most likely idle in the meantime.
+static const uint s_maxEstimateGap = 4;
+
+static std::chrono::nanoseconds currentTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+static timespec makeTimespec(const std::chrono::nanoseconds& time)
+{
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(time);
+
+    timespec ts;
+    ts.tv_sec = seconds.count();
+    ts.tv_nsec = (time - seconds).count();
+
+    return ts;
+}
+
+DrmFrameScheduler::DrmFrameScheduler(DrmOutput* output, QObject* parent)
+    : QObject(parent)
+    , m_output(output)
+    , m_safetyMargin(std::chrono::milliseconds(3))
+{
+    // The page flip timestamps are reported in CLOCK_MONOTONIC, so use a timer
+    // on the same clock, QTimer doesn't go below millisecond precision.
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd == -1)
+        return;
+
+    // Frames are not rendered while the session is inactive, pick up from where
+    // we left off once it comes back.
+    const SessionController* sessionController = output->device()->context()->sessionController();
+    connect(sessionController, &SessionController::activeChanged, this, [this] {
+        if (m_isRepaintScheduled && !m_output->isFlipPending())
+            armTimer();
+    });
+
+    m_notifier = new QSocketNotifier(m_timerFd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, [this] {
+        uint64_t expirations;
+        if (read(m_timerFd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            return;
+        renderFrame();
+    });
+}
+
+DrmFrameScheduler::~DrmFrameScheduler()
+{
+    if (m_timerFd != -1)
+        close(m_timerFd);
+}
+
+std::chrono::nanoseconds DrmFrameScheduler::safetyMargin() const
+{
+    return m_safetyMargin;
+}
+
+void DrmFrameScheduler::setSafetyMargin(const std::chrono::nanoseconds& margin)
+{
+    m_safetyMargin = margin;
+}
+
+static std::chrono::nanoseconds nominalRefreshInterval(const DrmOutput* output)
+{
+    const uint32_t refreshRate = output->desiredMode().refreshRate();
+    if (!refreshRate)
+        return s_defaultRefreshInterval;
+
+    // The refresh rate is in mHz.
+    return std::chrono::nanoseconds(1000000000000ull / refreshRate);
+}
+
+std::chrono::nanoseconds DrmFrameScheduler::refreshInterval() const
+{
+    const std::chrono::nanoseconds measuredInterval = measuredRefreshInterval();
+    if (measuredInterval.count() > 0)
+        return measuredInterval;
+
+    return nominalRefreshInterval(m_output);
+}
+
+std::chrono::nanoseconds DrmFrameScheduler::measuredRefreshInterval() const
+{
+    if (m_estimateSamples < s_minEstimateSamples)
+        return std::chrono::nanoseconds::zero();
+
+    return m_estimatedInterval;
+}
+
+static std::chrono::nanoseconds minimumVrrInterval(const DrmOutput* output,
+    const std::chrono::nanoseconds& refreshInterval)
+{
+    // The mode usually runs at the highest refresh rate of the panel already.
+    const EDID* edid = output->connector()->edid();
+    if (!edid || !edid->maximumRefreshRate())
+        return refreshInterval;
+
+    const std::chrono::nanoseconds interval(1000000000ll / edid->maximumRefreshRate());
+    return qMax(refreshInterval, interval);
+}
+
+static std::chrono::nanoseconds maximumVrrInterval(const DrmOutput* output)
+{
+    // If the next frame doesn't arrive in time, the panel shows the last one
+    // again. Zero means that the range of the panel is unknown.
+    const EDID* edid = output->connector()->edid();
+    if (!edid || !edid->minimumRefreshRate())
+        return std::chrono::nanoseconds::zero();
+
+    return std::chrono::nanoseconds(1000000000ll / edid->minimumRefreshRate());
+}
+
+std::chrono::nanoseconds DrmFrameScheduler::nextPresentationTime() const
+{
+    const std::chrono::nanoseconds now = currentTime();
+    const std::chrono::nanoseconds lastPresentationTime = m_output->timestamp();
+    if (lastPresentationTime.count() <= 0)
+        return now;
+
+    const std::chrono::nanoseconds interval = refreshInterval();
+    const std::chrono::nanoseconds deadline = now + m_safetyMargin;
+
+    // Frames are shown as soon as they arrive, as long as the time since the
+    // last refresh is within the range of the panel. If a frame is later than
+    // that, the panel repeats the last one and can't take a new one until
+    // it has been scanned out.
+    if (m_output->isVrrEnabled()) {
+        const std::chrono::nanoseconds minimumInterval = minimumVrrInterval(m_output, interval);
+        const std::chrono::nanoseconds maximumInterval = maximumVrrInterval(m_output);
+
+        std::chrono::nanoseconds lastRefreshTime = lastPresentationTime;
+        if (maximumInterval > minimumInterval && deadline > lastPresentationTime + maximumInterval)
+            lastRefreshTime += (deadline - lastPresentationTime) / maximumInterval * maximumInterval;
+
+        return qMax(lastRefreshTime + minimumInterval, deadline);
+    }
+
+    std::chrono::nanoseconds presentationTime = lastPresentationTime + interval;
+    if (presentationTime < deadline)
+        presentationTime += ((deadline - presentationTime) / interval + 1) * interval;
+
+    return presentationTime;
+}
+
+void DrmFrameScheduler::scheduleRepaint(const QRegion& region)
+{
+    m_damage += region;
+
+    if (m_isRepaintScheduled)
+        return;
+
+    m_isRepaintScheduled = true;
+
+    // If a frame is in flight, the timer is armed once it has been presented.
+    if (!m_output->isFlipPending())
+        armTimer();
+}
+
+bool DrmFrameScheduler::isRepaintScheduled() const
+{
+    return m_isRepaintScheduled;
+}
+
+void DrmFrameScheduler::notifyFramePresented(uint sequence, const std::chrono::nanoseconds& timestamp)
+{
+    updateRefreshEstimate(sequence, timestamp);
+
+    if (m_targetSequence) {
+        if (sequence > m_targetSequence)
+            m_statistics.missedFrames += sequence - m_targetSequence;
+        m_statistics.presentedFrames++;
+        m_targetSequence = 0;
+    }
+
+    if (m_isRepaintScheduled)
+        armTimer();
+}
+
+DrmFrameStatistics DrmFrameScheduler::statistics() const
+{
+    return m_statistics;
+}
+
+void DrmFrameScheduler::resetStatistics()
+{
+    m_statistics = DrmFrameStatistics();
+}
+
+void DrmFrameScheduler::armTimer()
+{
+    if (m_timerFd == -1)
+        return;
+
+    // Start rendering as late as possible, but early enough to make it.
+    const std::chrono::nanoseconds presentationTime = nextPresentationTime();
+    const std::chrono::nanoseconds renderTime = qMax(presentationTime - m_safetyMargin,
+        std::chrono::nanoseconds(1));
+
+    if (m_output->timestamp().count() > 0) {
+        if (m_output->isVrrEnabled()) {
+            // The panel refreshes as soon as the frame arrives, after the
+            // repeats of the last frame that it has had to do.
+            const std::chrono::nanoseconds maximumInterval = maximumVrrInterval(m_output);
+            uint repeats = 0;
+            if (maximumInterval.count() > 0)
+                repeats = (presentationTime - m_output->timestamp()) / maximumInterval;
+            m_targetSequence = m_output->sequence() + 1 + repeats;
+        } else {
+            const std::chrono::nanoseconds elapsed = presentationTime - m_output->timestamp();
+            m_targetSequence = m_output->sequence() + elapsed / refreshInterval();
+        }
+    }
+
+    itimerspec spec = {};
+    spec.it_value = makeTimespec(renderTime);
+
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void DrmFrameScheduler::updateRefreshEstimate(uint sequence, const std::chrono::nanoseconds& timestamp)
+{
+    const uint previousSequence = m_lastFlipSequence;
+    const std::chrono::nanoseconds previousTimestamp = m_lastFlipTimestamp;
+
+    m_lastFlipSequence = sequence;
+    m_lastFlipTimestamp = timestamp;
+
+    if (previousTimestamp.count() <= 0)
+        return;
+
+    const uint vblanks = sequence - previousSequence;
+    if (!vblanks || vblanks > s_maxEstimateGap || timestamp <= previousTimestamp)
+        return;
+
+    const std::chrono::nanoseconds sample = (timestamp - previousTimestamp) / vblanks;
+
+    // Start over if the sample is way off, e.g. because the mode has changed.
+    // With variable refresh rate, the panel waits for late frames, so only
+    // frames that follow each other at the highest rate tell its interval.
+    const std::chrono::nanoseconds nominalInterval = nominalRefreshInterval(m_output);
+    if (qAbs((sample - nominalInterval).count()) > nominalInterval.count() / 10) {
+        if (!m_output->isVrrEnabled())
+            m_estimateSamples = 0;
+        return;
+    }
+
+    // An exponential moving average smooths out the jitter of the timestamps.
+    if (!m_estimateSamples)
+        m_estimatedInterval = sample;
+    else
+        m_estimatedInterval += (sample - m_estimatedInterval) / 16;
+
+    if (m_estimateSamples < s_minEstimateSamples)
+        m_estimateSamples++;
+}
+
+void DrmFrameScheduler::renderFrame()
+{
+    if (!m_isRepaintScheduled)
+        return;
+
+    // We're late, the previous frame hasn't been presented yet.
+    if (m_output->isFlipPending())
+        return;
+
+    DrmDevice* device = m_output->device();
+    if (!device->context()->sessionController()->isActive())
+        return;
+
+    DrmFrameTimeline* timeline = m_output->frameTimeline();
+    timeline->beginFrame(m_targetSequence);
+
+    // Layers that can go onto hardware planes don't have to be composited.
+    const DrmLayerList layers = m_output->assignPlanes(m_output->layers());
+
+    if (DrmImage* directImage = m_output->directScanoutImage()) {
+        const QRegion damage = m_damage;
+
+        m_isRepaintScheduled = false;
+        m_damage = QRegion();
+
+        // The client image is scanned out, nothing has to be rendered.
+        m_output->setPendingImage(directImage);
+        timeline->mark(DrmFrameStageRenderEnd);
+        m_output->present(damage);
+        return;
+    }
+
+    NativeRenderer* renderer = device->renderer();
+    if (!renderer->beginFrame(m_output)) {
+        timeline->abortFrame();
+
+        // Without a flip in flight, no page flip is going to arm the timer, so
+        // try again in the next refresh cycle. An output without a swapchain
+        // gets a repaint once it's routed, the damage is kept until then.
+        if (m_output->swapchain())
+            armTimer();
+        else
+            m_isRepaintScheduled = false;
+        return;
+    }
+
+    const QRegion damage = m_damage;
+
+    m_isRepaintScheduled = false;
+    m_damage = QRegion();
+
+    // Only what has changed since the image was last shown is painted.
+    renderer->paint(m_output, layers, renderer->repaintRegion(m_output, damage));
+    renderer->finishFrame(m_output, damage);
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "globals.h"
+
+#include <QObject>
+#include <QRegion>
+
+#include <chrono>
+
+class QSocketNotifier;
+
+struct DrmFrameStatistics {
+    /**
+     * The number of frames that have reached the screen.
+     */
+    uint64_t presentedFrames = 0;
+
+    /**
+     * The number of vblanks that were missed by the presented frames.
+     */
+    uint64_t missedFrames = 0;
+};
+
+class DrmFrameScheduler : public QObject {
+    Q_OBJECT
+
+public:
+    explicit DrmFrameScheduler(DrmOutput* output, QObject* parent = nullptr);
+    ~DrmFrameScheduler() override;
+
+    /**
+     * Returns how long before the predicted vblank rendering starts.
+     */
+    std::chrono::nanoseconds safetyMargin() const;
+
+    /**
+     * Sets how long before the predicted vblank rendering starts.
+     *
+     * The margin must cover the time it takes to render and commit a frame,
+     * the smaller it is, the lower the latency.
+     */
+    void setSafetyMargin(const std::chrono::nanoseconds& margin);
+
+    /**
+     * Returns the duration of a refresh cycle of the output.
+     *
+     * Once enough frames have been presented, this is the interval measured
+     * from the page flip timestamps rather than the nominal one of the mode.
+     */
+    std::chrono::nanoseconds refreshInterval() const;
+
+    /**
+     * Returns the refresh interval measured from the page flip timestamps,
+     * or zero if there aren't enough samples yet.
+     *
+     * With variable refresh rate, only frames that have been presented at the
+     * highest refresh rate are taken into account.
+     */
+    std::chrono::nanoseconds measuredRefreshInterval() const;
+
+    /**
+     * Returns the predicted time of the next vblank that can still be hit.
+     *
+     * With variable refresh rate, frames don't have to wait for a vblank, so
+     * this is as soon as a frame can be rendered, but not before the panel
+     * can refresh again. The range of refresh rates that the EDID of the
+     * panel reports is taken into account.
+     */
+    std::chrono::nanoseconds nextPresentationTime() const;
+
+    /**
+     * Requests a new frame that repaints the given @p region.
+     */
+    void scheduleRepaint(const QRegion& region);
+
+    /**
+     * Returns whether a frame has been requested and not rendered yet.
+     */
+    bool isRepaintScheduled() const;
+
+    /**
+     * Notifies the scheduler that a frame has been presented.
+     */
+    void notifyFramePresented(uint sequence, const std::chrono::nanoseconds& timestamp);
+
+    /**
+     * Returns statistics about presented frames.
+     */
+    DrmFrameStatistics statistics() const;
+
+    /**
+     * Resets the frame statistics.
+     */
+    void resetStatistics();
+
+private:
+    void armTimer();
+    void renderFrame();
+    void updateRefreshEstimate(uint sequence, const std::chrono::nanoseconds& timestamp);
+
+    DrmOutput* m_output;
+    QSocketNotifier* m_notifier = nullptr;
+    QRegion m_damage;
+    DrmFrameStatistics m_statistics;
+    std::chrono::nanoseconds m_safetyMargin;
+    std::chrono::nanoseconds m_estimatedInterval = std::chrono::nanoseconds::zero();
+    std::chrono::nanoseconds m_lastFlipTimestamp = std::chrono::nanoseconds::zero();
+    uint m_lastFlipSequence = 0;
+    int m_estimateSamples = 0;
+    uint m_targetSequence = 0;
+    int m_timerFd = -1;
+    bool m_isRepaintScheduled = false;
+
+    Q_DISABLE_COPY(DrmFrameScheduler)
+};
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DrmFrameTimeline.h"
+#include "DrmConnector.h"
+#include "DrmOutput.h"
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <cstring>
+#include <type_traits>
+
+#include <time.h>
+
+static_assert(std::is_trivially_copyable<DrmFrameTiming>::value,
+    "Timings are copied into the ring buffer word by word");
+
+static std::chrono::nanoseconds currentTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+DrmFrameTimeline::DrmFrameTimeline()
+    : m_head(0)
+{
+    for (Slot& slot : m_slots) {
+        slot.sequence.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint64_t>& word : slot.words)
+            word.store(0, std::memory_order_relaxed);
+    }
+}
+
+void DrmFrameTimeline::beginFrame(uint targetSequence)
+{
+    // The previous frame never made it to a commit.
+    if (m_isFrameActive)
+        abortFrame();
+
+    m_current = DrmFrameTiming();
+    m_current.frame = ++m_frameCounter;
+    m_current.renderStart = currentTime();
+    m_targetSequence = targetSequence;
+    m_isFrameActive = true;
+}
+
+void DrmFrameTimeline::mark(DrmFrameStage stage)
+{
+    if (m_isFrameActive)
+        mark(stage, currentTime());
+}
+
+void DrmFrameTimeline::mark(DrmFrameStage stage, const std::chrono::nanoseconds& timestamp)
+{
+    if (!m_isFrameActive)
+        return;
+
+    switch (stage) {
+    case DrmFrameStageAcquire:
+        m_current.acquire = timestamp;
+        break;
+    case DrmFrameStageRenderEnd:
+        m_current.renderEnd = timestamp;
+        break;
+    case DrmFrameStageCommitSubmit:
+        m_current.commitSubmit = timestamp;
+        break;
+    case DrmFrameStageCommitReturn:
+        m_current.commitReturn = timestamp;
+        break;
+    }
+}
+
+void DrmFrameTimeline::finishFrame(uint sequence, const std::chrono::nanoseconds& timestamp)
+{
+    if (!m_isFrameActive)
+        return;
+
+    m_current.flip = timestamp;
+    m_current.sequence = sequence;
+    m_current.isPresented = true;
+    if (m_targetSequence && sequence > m_targetSequence)
+        m_current.missedVblanks = sequence - m_targetSequence;
+
+    push();
+}
+
+void DrmFrameTimeline::abortFrame()
+{
+    if (!m_isFrameActive)
+        return;
+
+    push();
+}
+
+bool DrmFrameTimeline::isFrameActive() const
+{
+    return m_isFrameActive;
+}
+
+uint64_t DrmFrameTimeline::frameCount() const
+{
+    return m_head.load(std::memory_order_acquire);
+}
+
+void DrmFrameTimeline::push()
+{
+    const uint64_t head = m_head.load(std::memory_order_relaxed);
+    Slot& slot = m_slots[head % capacity];
+
+    // The entry is copied word by word, so readers never race with a plain
+    // write. They check the sequence to throw away torn copies.
+    uint64_t words[slotWordCount] = {};
+    memcpy(words, &m_current, sizeof(m_current));
+
+    const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (int i = 0; i < slotWordCount; ++i)
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+
+    // Readers only look at entries below the head.
+    m_head.store(head + 1, std::memory_order_release);
+
+    m_isFrameActive = false;
+}
+
+bool DrmFrameTimeline::read(uint64_t index, DrmFrameTiming* timing) const
+{
+    const Slot& slot = m_slots[index % capacity];
+
+    const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence & 1)
+        return false;
+
+    uint64_t words[slotWordCount];
+    for (int i = 0; i < slotWordCount; ++i)
+        words[i] = slot.words[i].load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+        return false;
+
+    memcpy(timing, words, sizeof(*timing));
+
+    // Every begun frame is pushed exactly once and in order, so a different
+    // frame number means that the writer has lapped us.
+    return timing->frame == index + 1;
+}
+
+QVector<DrmFrameTiming> DrmFrameTimeline::timings(int count) const
+{
+    const uint64_t head = m_head.load(std::memory_order_acquire);
+    const uint64_t available = qMin<uint64_t>(head, qBound(0, count, capacity));
+
+    QVector<DrmFrameTiming> timings;
+    timings.reserve(int(available));
+
+    // Entries that are being overwritten are dropped rather than retried,
+    // they belong to the oldest frames anyway.
+    for (uint64_t i = head - available; i < head; ++i) {
+        DrmFrameTiming timing;
+        if (read(i, &timing))
+            timings << timing;
+    }
+
+    return timings;
+}
+
+static double toMicroseconds(const std::chrono::nanoseconds& time)
+{
+    return time.count() / 1000.0;
+}
+
+static QJsonObject makeSlice(const QString& name, int trackId,
+    const std::chrono::nanoseconds& start, const std::chrono::nanoseconds& end,
+    const QJsonObject& args)
+{
+    QJsonObject event;
+    event[QStringLiteral("name")] = name;
+    event[QStringLiteral("ph")] = QStringLiteral("X");
+    event[QStringLiteral("pid")] = 1;
+    event[QStringLiteral("tid")] = trackId;
+    event[QStringLiteral("ts")] = toMicroseconds(start);
+    event[QStringLiteral("dur")] = toMicroseconds(end - start);
+    event[QStringLiteral("args")] = args;
+    return event;
+}
+
+QJsonArray DrmFrameTimeline::traceEvents(int trackId, const QString& trackName) const
+{
+    QJsonArray events;
+
+    QJsonObject metadata;
+    metadata[QStringLiteral("name")] = QStringLiteral("thread_name");
+    metadata[QStringLiteral("ph")] = QStringLiteral("M");
+    metadata[QStringLiteral("pid")] = 1;
+    metadata[QStringLiteral("tid")] = trackId;
+    metadata[QStringLiteral("args")] = QJsonObject { { QStringLiteral("name"), trackName } };
+    events.append(metadata);
+
+    for (const DrmFrameTiming& timing : timings()) {
+        QJsonObject args;
+        args[QStringLiteral("frame")] = double(timing.frame);
+        args[QStringLiteral("presented")] = timing.isPresented;
+        if (timing.isPresented) {
+            args[QStringLiteral("sequence")] = double(timing.sequence);
+            args[QStringLiteral("missedVblanks")] = double(timing.missedVblanks);
+        }
+
+        if (timing.renderEnd.count()) {
+            QJsonObject renderArgs = args;
+            if (timing.acquire.count())
+                renderArgs[QStringLiteral("acquireUs")] = toMicroseconds(timing.acquire - timing.renderStart);
+            events.append(makeSlice(QStringLiteral("render"), trackId,
+                timing.renderStart, timing.renderEnd, renderArgs));
+        }
+
+        if (timing.commitReturn.count()) {
+            events.append(makeSlice(QStringLiteral("commit"), trackId,
+                timing.commitSubmit, timing.commitReturn, args));
+        }
+
+        if (timing.isPresented && timing.commitReturn.count()) {
+            const QString name = timing.missedVblanks
+                ? QStringLiteral("flip (missed)")
+                : QStringLiteral("flip");
+            events.append(makeSlice(name, trackId, timing.commitReturn, timing.flip, args));
+        }
+    }
+
+    return events;
+}
+
+bool DrmFrameTimeline::writeTrace(const QString& fileName, const DrmOutputList& outputs)
+{
+    QJsonArray events;
+
+    int trackId = 0;
+    for (const DrmOutput* output : outputs) {
+        const QJsonArray outputEvents = output->frameTimeline()->traceEvents(++trackId,
+            output->connector()->name());
+        for (const QJsonValue& event : outputEvents)
+            events.append(event);
+    }
+
+    QJsonObject trace;
+    trace[QStringLiteral("traceEvents")] = events;
+    trace[QStringLiteral("displayTimeUnit")] = QStringLiteral("ms");
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    const QByteArray data = QJsonDocument(trace).toJson(QJsonDocument::Compact);
+    return file.write(data) == data.size();
+}
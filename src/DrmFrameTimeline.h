@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "globals.h"
+
+#include <QJsonArray>
+#include <QVector>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+/**
+ * Timestamps of a single frame, in CLOCK_MONOTONIC.
+ *
+ * Stages that the frame didn't reach are zero.
+ */
+struct DrmFrameTiming {
+    /**
+     * The number of the frame, counted per output.
+     */
+    uint64_t frame = 0;
+
+    /**
+     * When the frame scheduler started the frame.
+     */
+    std::chrono::nanoseconds renderStart = std::chrono::nanoseconds::zero();
+
+    /**
+     * When an image has been acquired from the swapchain.
+     */
+    std::chrono::nanoseconds acquire = std::chrono::nanoseconds::zero();
+
+    /**
+     * When rendering has finished and the frame has been presented.
+     */
+    std::chrono::nanoseconds renderEnd = std::chrono::nanoseconds::zero();
+
+    /**
+     * When the atomic commit has been handed to the kernel.
+     */
+    std::chrono::nanoseconds commitSubmit = std::chrono::nanoseconds::zero();
+
+    /**
+     * When the kernel has returned from the atomic commit.
+     */
+    std::chrono::nanoseconds commitReturn = std::chrono::nanoseconds::zero();
+
+    /**
+     * The vblank at which the frame has reached the screen.
+     */
+    std::chrono::nanoseconds flip = std::chrono::nanoseconds::zero();
+
+    /**
+     * The vblank sequence number at which the frame has reached the screen.
+     */
+    uint sequence = 0;
+
+    /**
+     * The number of vblanks the frame has missed its target by.
+     */
+    uint missedVblanks = 0;
+
+    /**
+     * Whether the frame has reached the screen, rather than being dropped.
+     */
+    bool isPresented = false;
+};
+
+/**
+ * This enum type is used to specify stages of a frame.
+ */
+enum DrmFrameStage {
+    DrmFrameStageAcquire,
+    DrmFrameStageRenderEnd,
+    DrmFrameStageCommitSubmit,
+    DrmFrameStageCommitReturn,
+};
+
+/**
+ * Records timings of the most recent frames of an output.
+ *
+ * The timeline is always on, recording a stage costs a clock read. Finished
+ * frames are kept in a ring buffer, which is written only by the thread the
+ * output lives in, but can be read from any thread without locking. Every
+ * slot has a sequence counter, so readers can tell when the writer has
+ * touched an entry while they were copying it.
+ */
+class DrmFrameTimeline {
+public:
+    /**
+     * The number of frames that are kept.
+     */
+    static const int capacity = 256;
+
+    DrmFrameTimeline();
+
+    /**
+     * Starts a new frame that should reach the screen at the vblank with the
+     * given @p targetSequence, or 0 if there is no particular target.
+     */
+    void beginFrame(uint targetSequence);
+
+    /**
+     * Records that the current frame has reached the given @p stage. Nothing
+     * is recorded if there is no current frame.
+     */
+    void mark(DrmFrameStage stage);
+
+    /**
+     * Records that the current frame has reached the given @p stage at the
+     * given @p timestamp, e.g. when the stage has been passed on another thread.
+     */
+    void mark(DrmFrameStage stage, const std::chrono::nanoseconds& timestamp);
+
+    /**
+     * Finishes the current frame, which has reached the screen.
+     */
+    void finishFrame(uint sequence, const std::chrono::nanoseconds& timestamp);
+
+    /**
+     * Finishes the current frame, which has been dropped.
+     */
+    void abortFrame();
+
+    /**
+     * Returns whether a frame is in progress.
+     */
+    bool isFrameActive() const;
+
+    /**
+     * Returns the total number of finished frames.
+     */
+    uint64_t frameCount() const;
+
+    /**
+     * Returns up to @p count most recent finished frames, oldest first.
+     */
+    QVector<DrmFrameTiming> timings(int count = capacity) const;
+
+    /**
+     * Returns the finished frames as Chrome trace events, which can be loaded
+     * in Perfetto or chrome://tracing. Every output gets a track @p trackId
+     * named @p trackName.
+     */
+    QJsonArray traceEvents(int trackId, const QString& trackName) const;
+
+    /**
+     * Writes a Chrome trace with the timelines of the given @p outputs to the
+     * file with the given @p fileName.
+     */
+    static bool writeTrace(const QString& fileName, const DrmOutputList& outputs);
+
+private:
+    static const int slotWordCount = (sizeof(DrmFrameTiming) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    struct Slot {
+        // Odd while the slot is being written.
+        std::atomic<uint32_t> sequence;
+        std::array<std::atomic<uint64_t>, slotWordCount> words;
+    };
+
+    void push();
+    bool read(uint64_t index, DrmFrameTiming* timing) const;
+
+    std::array<Slot, capacity> m_slots;
+    std::atomic<uint64_t> m_head;
+    DrmFrameTiming m_current;
+    uint m_targetSequence = 0;
+    uint64_t m_frameCounter = 0;
+    bool m_isFrameActive = false;
+
+    Q_DISABLE_COPY(DrmFrameTimeline)
+};
@@ -17,20 +17,81 @@
  */
 
 #include "DrmGbmAllocator.h"
+#include "DrmBuffer.h"
 #include "DrmDevice.h"
 #include "DrmGbmImage.h"
 
 #include <QVector>
 
+#include <drm_fourcc.h>
+
+#include <memory>
+
+// Enough to keep the triple buffered swapchains of a few outputs around.
+static const int maxPooledImages = 8;
+
+static EGLDisplay createDisplay(gbm_device* gbm)
+{
+    if (!gbm)
+        return EGL_NO_DISPLAY;
+
+    if (!epoxy_has_egl_extension(EGL_NO_DISPLAY, "EGL_EXT_platform_base"))
+        return EGL_NO_DISPLAY;
+    if (!epoxy_has_egl_extension(EGL_NO_DISPLAY, "EGL_KHR_platform_gbm")
+        && !epoxy_has_egl_extension(EGL_NO_DISPLAY, "EGL_MESA_platform_gbm"))
+        return EGL_NO_DISPLAY;
+
+    EGLDisplay display = eglGetPlatformDisplayEXT(EGL_PLATFORM_GBM_KHR, gbm, nullptr);
+    if (display == EGL_NO_DISPLAY)
+        return EGL_NO_DISPLAY;
+
+    if (!eglInitialize(display, nullptr, nullptr))
+        return EGL_NO_DISPLAY;
+
+    // The display is only needed to learn what layouts the GPU can render to.
+    if (!epoxy_has_egl_extension(display, "EGL_EXT_image_dma_buf_import_modifiers")) {
+        eglTerminate(display);
+        return EGL_NO_DISPLAY;
+    }
+
+    return display;
+}
+
+static QVector<uint64_t> queryModifiers(EGLDisplay display, uint32_t format)
+{
+    EGLint count = 0;
+    if (!eglQueryDmaBufModifiersEXT(display, format, 0, nullptr, nullptr, &count) || !count)
+        return QVector<uint64_t>();
+
+    QVector<EGLuint64KHR> modifiers(count);
+    QVector<EGLBoolean> externalOnly(count);
+    if (!eglQueryDmaBufModifiersEXT(display, format, count, modifiers.data(), externalOnly.data(), &count))
+        return QVector<uint64_t>();
+
+    // External only layouts can be sampled from, but not rendered to.
+    QVector<uint64_t> renderableModifiers;
+    for (int i = 0; i < count; ++i) {
+        if (!externalOnly.at(i))
+            renderableModifiers << modifiers.at(i);
+    }
+
+    return renderableModifiers;
+}
+
 DrmGbmAllocator::DrmGbmAllocator(DrmDevice* device, QObject* parent)
     : DrmAllocator(parent)
     , m_device(device)
     , m_gbm(gbm_create_device(device->fd()))
+    , m_eglDisplay(createDisplay(m_gbm))
 {
 }
 
 DrmGbmAllocator::~DrmGbmAllocator()
 {
+    qDeleteAll(m_pool);
+
+    if (m_eglDisplay != EGL_NO_DISPLAY)
+        eglTerminate(m_eglDisplay);
     if (m_gbm)
         gbm_device_destroy(m_gbm);
 }
@@ -40,19 +101,98 @@ bool DrmGbmAllocator::isValid() const
     return m_gbm;
 }
 
+QVector<uint64_t> DrmGbmAllocator::modifiers(uint32_t format) const
+{
+    if (m_eglDisplay == EGL_NO_DISPLAY)
+        return QVector<uint64_t>();
+
+    auto it = m_modifiers.constFind(format);
+    if (it == m_modifiers.constEnd())
+        it = m_modifiers.insert(format, queryModifiers(m_eglDisplay, format));
+
+    return *it;
+}
+
 DrmImage* DrmGbmAllocator::allocate(uint32_t width, uint32_t height, uint32_t format,
     const QVector<uint64_t>& modifiers)
 {
-    // TODO: Without modifiers.
+    if (DrmGbmImage* image = takePooledImage(width, height, format, modifiers))
+        return image;
+
+    QVector<uint64_t> candidates = modifiers;
+
+    while (!candidates.isEmpty()) {
+        gbm_bo* bo = gbm_bo_create_with_modifiers(m_gbm, width, height, format,
+            candidates.data(), candidates.count());
+        if (!bo)
+            break;
+
+        const uint64_t modifier = gbm_bo_get_modifier(bo);
 
-    gbm_bo* bo = nullptr;
-    if (!modifiers.isEmpty())
-        bo = gbm_bo_create_with_modifiers(m_gbm, width, height, format, modifiers.data(), modifiers.count());
-    else
-        bo = gbm_bo_create(m_gbm, width, height, format, GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT);
+        auto image = std::make_unique<DrmGbmImage>(m_device, bo, false);
+        if (image->isValid())
+            return image.release();
 
+        // The display engine may reject a layout that the GPU picked, e.g. a
+        // compressed one for a mode with high bandwidth. Try the next best.
+        if (!candidates.removeAll(modifier))
+            break;
+    }
+
+    // Without modifiers, a linear layout has to be asked for explicitly.
+    uint32_t flags = GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT;
+    if (modifiers == QVector<uint64_t>{ DRM_FORMAT_MOD_LINEAR })
+        flags |= GBM_BO_USE_LINEAR;
+
+    gbm_bo* bo = gbm_bo_create(m_gbm, width, height, format, flags);
     if (!bo)
         return nullptr;
 
-    return new DrmGbmImage(m_device, bo);
+    return new DrmGbmImage(m_device, bo, true);
+}
+
+void DrmGbmAllocator::recycle(DrmImage* image)
+{
+    auto gbmImage = static_cast<DrmGbmImage*>(image);
+    if (!gbmImage->isValid()) {
+        delete gbmImage;
+        return;
+    }
+
+    // The render fence belongs to a commit that has already returned.
+    gbmImage->setRenderFence(-1);
+
+    m_pool << gbmImage;
+
+    while (m_pool.count() > maxPooledImages)
+        delete m_pool.takeFirst();
+}
+
+DrmGbmImage* DrmGbmAllocator::takePooledImage(uint32_t width, uint32_t height,
+    uint32_t format, const QVector<uint64_t>& modifiers)
+{
+    // Prefer the most recently recycled image, it's the most likely one to
+    // be still resident.
+    for (int i = m_pool.count() - 1; i >= 0; --i) {
+        DrmGbmImage* image = m_pool.at(i);
+        const DrmBuffer* buffer = image->buffer();
+
+        if (buffer->width() != width || buffer->height() != height)
+            continue;
+        if (buffer->format() != format)
+            continue;
+
+        if (modifiers.isEmpty()) {
+            if (!image->isImplicit())
+                continue;
+        } else {
+            if (image->isImplicit() || !modifiers.contains(buffer->modifier()))
+                continue;
+        }
+
+        m_pool.remove(i);
+        return image;
+    }
+
+    return nullptr;
 }
@@ -20,6 +20,12 @@
 
 #include "DrmAllocator.h"
 
+class DrmGbmImage;
+
+#include <QHash>
+#include <QVector>
+
+#include <epoxy/egl.h>
 #include <gbm.h>
 
 class DrmGbmAllocator : public DrmAllocator {
@@ -30,12 +36,24 @@ public:
     ~DrmGbmAllocator() override;
 
     bool isValid() const override;
+    QVector<uint64_t> modifiers(uint32_t format) const override;
     DrmImage* allocate(uint32_t width, uint32_t height, uint32_t format,
         const QVector<uint64_t>& modifiers) override;
+    void recycle(DrmImage* image) override;
 
 private:
+    DrmGbmImage* takePooledImage(uint32_t width, uint32_t height, uint32_t format,
+        const QVector<uint64_t>& modifiers);
+
     DrmDevice* m_device = nullptr;
     gbm_device* m_gbm = nullptr;
+    EGLDisplay m_eglDisplay = EGL_NO_DISPLAY;
+    mutable QHash<uint32_t, QVector<uint64_t>> m_modifiers;
+
+    // Images of destroyed swapchains, least recently recycled first. They keep
+    // their frame buffers, so recreating a swapchain with the same geometry
+    // doesn't have to go through the kernel.
+    QVector<DrmGbmImage*> m_pool;
 
     Q_DISABLE_COPY(DrmGbmAllocator)
 };
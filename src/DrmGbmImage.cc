@@ -22,8 +22,9 @@
 
 #include <drm_fourcc.h>
 
-DrmGbmImage::DrmGbmImage(DrmDevice* device, gbm_bo* bo)
+DrmGbmImage::DrmGbmImage(DrmDevice* device, gbm_bo* bo, bool isImplicit)
     : m_bo(bo)
+    , m_isImplicit(isImplicit)
 {
     const uint32_t width = gbm_bo_get_width(m_bo);
     const uint32_t height = gbm_bo_get_height(m_bo);
@@ -56,3 +57,8 @@ DrmBuffer* DrmGbmImage::buffer() const
 {
     return m_buffer;
 }
+
+bool DrmGbmImage::isImplicit() const
+{
+    return m_isImplicit;
+}
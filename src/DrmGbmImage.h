@@ -24,14 +24,21 @@
 
 class DrmGbmImage : public DrmImage {
 public:
-    DrmGbmImage(DrmDevice* device, gbm_bo* bo);
+    DrmGbmImage(DrmDevice* device, gbm_bo* bo, bool isImplicit);
     ~DrmGbmImage() override;
 
     DrmBuffer* buffer() const override;
 
+    /**
+     * Returns whether the layout of this image was picked by the driver
+     * rather than from a list of modifiers.
+     */
+    bool isImplicit() const;
+
 private:
     DrmBuffer* m_buffer = nullptr;
     gbm_bo* m_bo = nullptr;
+    bool m_isImplicit = false;
 
     Q_DISABLE_COPY(DrmGbmImage)
 };
@@ -17,9 +17,23 @@
  */
 
 #include "DrmImage.h"
+#include "DrmAllocator.h"
+#include "DrmSwapchain.h"
+
+#include <utility>
+
+#include <unistd.h>
+
+static void replaceFence(int* fence, int fd)
+{
+    if (*fence != -1)
+        close(*fence);
+    *fence = fd;
+}
 
 DrmImage::~DrmImage()
 {
+    replaceFence(&m_renderFence, -1);
 }
 
 bool DrmImage::isValid() const
@@ -27,9 +41,45 @@ bool DrmImage::isValid() const
     return buffer();
 }
 
+void* DrmImage::data() const
+{
+    return nullptr;
+}
+
+uint32_t DrmImage::stride() const
+{
+    return 0;
+}
+
+int DrmImage::age() const
+{
+    if (!m_swapchain || !m_frame)
+        return 0;
+
+    return m_swapchain->m_frameCounter - m_frame + 1;
+}
+
 void DrmImage::release()
 {
+    if (!m_isBusy)
+        return;
+
     m_isBusy = false;
+
+    if (m_swapchain)
+        m_swapchain->release(this);
+    else if (m_allocator)
+        std::exchange(m_allocator, nullptr)->recycle(this);
+}
+
+int DrmImage::renderFence() const
+{
+    return m_renderFence;
+}
+
+void DrmImage::setRenderFence(int fd)
+{
+    replaceFence(&m_renderFence, fd);
 }
 
 bool DrmImage::isBusy() const
@@ -34,11 +34,50 @@ public:
      */
     virtual DrmBuffer* buffer() const = 0;
 
+    /**
+     * Returns the CPU mapping of this image.
+     *
+     * If the CPU can't access the image, e.g. because it lives in memory that
+     * only the GPU can map, @c null is returned.
+     */
+    virtual void* data() const;
+
+    /**
+     * Returns the number of bytes between two consecutive rows of data().
+     */
+    virtual uint32_t stride() const;
+
+    /**
+     * Returns the age of this image.
+     *
+     * The age tells how many frames old the contents of this image are, the
+     * most recently presented image has age 1. If the image has never been
+     * presented, its contents are undefined and 0 is returned.
+     */
+    int age() const;
+
     /**
      * Puts this image back to the swapchain.
+     *
+     * If the swapchain has been destroyed in the meantime, the image goes back
+     * to the allocator instead.
      */
     void release();
 
+    /**
+     * Returns a fence that signals when rendering into this image has
+     * finished, or -1 if there is nothing to wait for.
+     */
+    int renderFence() const;
+
+    /**
+     * Sets the render fence. The image takes ownership of the @p fd, which
+     * is closed once the commit that shows the image has returned.
+     *
+     * The native renderer draws on the CPU and doesn't attach one.
+     */
+    void setRenderFence(int fd);
+
 private:
     /**
      * Returns whether this image is currently being used.
@@ -50,6 +89,10 @@ private:
      */
     void setBusy(bool busy);
 
+    DrmSwapchain* m_swapchain = nullptr;
+    DrmAllocator* m_allocator = nullptr;
+    uint64_t m_frame = 0;
+    int m_renderFence = -1;
     bool m_isBusy = false;
 
     friend class DrmSwapchain;
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "globals.h"
+
+#include <QRect>
+#include <QVector>
+
+struct DrmLayer {
+    /**
+     * The image with the contents of this layer.
+     */
+    DrmImage* image = nullptr;
+
+    /**
+     * The area of the image that is shown, in image coordinates.
+     */
+    QRect sourceRect;
+
+    /**
+     * The area of the output that this layer covers, in output coordinates.
+     */
+    QRect targetRect;
+
+    /**
+     * Whether this layer has no translucent parts.
+     */
+    bool isOpaque = false;
+};
+
+typedef QVector<DrmLayer> DrmLayerList;
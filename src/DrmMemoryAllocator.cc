@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DrmMemoryAllocator.h"
+#include "DrmMemoryImage.h"
+
+#include <QVector>
+
+#include <drm_fourcc.h>
+
+#include <memory>
+
+DrmMemoryAllocator::DrmMemoryAllocator(DrmDevice* device, QObject* parent)
+    : DrmAllocator(parent)
+    , m_device(device)
+{
+}
+
+DrmMemoryAllocator::~DrmMemoryAllocator()
+{
+}
+
+bool DrmMemoryAllocator::isValid() const
+{
+    return true;
+}
+
+QVector<uint64_t> DrmMemoryAllocator::modifiers(uint32_t format) const
+{
+    Q_UNUSED(format)
+    return { DRM_FORMAT_MOD_LINEAR };
+}
+
+DrmImage* DrmMemoryAllocator::allocate(uint32_t width, uint32_t height, uint32_t format,
+    const QVector<uint64_t>& modifiers)
+{
+    if (!modifiers.isEmpty() && !modifiers.contains(DRM_FORMAT_MOD_LINEAR))
+        return nullptr;
+
+    auto image = std::make_unique<DrmMemoryImage>(m_device, width, height, format);
+    if (!image->isValid())
+        return nullptr;
+
+    return image.release();
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DrmMemoryImage.h"
+#include "DrmBuffer.h"
+
+#include <drm_fourcc.h>
+
+static bool isSupported(uint32_t format)
+{
+    switch (format) {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_ARGB8888:
+    case DRM_FORMAT_ABGR8888:
+        return true;
+    default:
+        return false;
+    }
+}
+
+DrmMemoryImage::DrmMemoryImage(DrmDevice* device, uint32_t width, uint32_t height, uint32_t format)
+{
+    if (!isSupported(format))
+        return;
+
+    m_stride = width * 4;
+    m_data = std::make_unique<uint8_t[]>(size_t(m_stride) * height);
+
+    // Memory images have no GEM handles, they only exist on virtual devices.
+    const std::array<uint32_t, 4> handles = { 0 };
+    const std::array<uint32_t, 4> strides = { m_stride };
+    const std::array<uint32_t, 4> offsets = { 0 };
+
+    m_buffer = DrmBuffer::create(device, width, height, format, handles, strides, offsets);
+}
+
+DrmMemoryImage::~DrmMemoryImage()
+{
+    delete m_buffer;
+}
+
+DrmBuffer* DrmMemoryImage::buffer() const
+{
+    return m_buffer;
+}
+
+void* DrmMemoryImage::data() const
+{
+    return m_data.get();
+}
+
+uint32_t DrmMemoryImage::stride() const
+{
+    return m_stride;
+}
@@ -46,6 +46,11 @@ DrmMode::DrmMode(const drmModeModeInfo& mode)
 {
 }
 
+bool DrmMode::isValid() const
+{
+    return m_width && m_height;
+}
+
 bool DrmMode::isPreferred() const
 {
     return m_isPreferred;
@@ -70,3 +75,21 @@ drmModeModeInfo DrmMode::data() const
 {
     return m_data;
 }
+
+bool DrmMode::operator==(const DrmMode& other) const
+{
+    const drmModeModeInfo& a = m_data;
+    const drmModeModeInfo& b = other.m_data;
+
+    return a.clock == b.clock
+        && a.hdisplay == b.hdisplay && a.hsync_start == b.hsync_start
+        && a.hsync_end == b.hsync_end && a.htotal == b.htotal && a.hskew == b.hskew
+        && a.vdisplay == b.vdisplay && a.vsync_start == b.vsync_start
+        && a.vsync_end == b.vsync_end && a.vtotal == b.vtotal && a.vscan == b.vscan
+        && a.flags == b.flags;
+}
+
+bool DrmMode::operator!=(const DrmMode& other) const
+{
+    return !(*this == other);
+}
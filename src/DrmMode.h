@@ -28,6 +28,11 @@ public:
     explicit DrmMode();
     DrmMode(const drmModeModeInfo& mode);
 
+    /**
+     * Whether this mode is valid, i.e. has a non-empty size.
+     */
+    bool isValid() const;
+
     /**
      * Whether this mode is preferred.
      */
@@ -53,10 +58,17 @@ public:
      */
     drmModeModeInfo data() const;
 
+    /**
+     * Two modes are equal if they have the same timings, regardless of their
+     * names and types.
+     */
+    bool operator==(const DrmMode& other) const;
+    bool operator!=(const DrmMode& other) const;
+
 private:
     bool m_isPreferred = false;
     uint32_t m_width = 0;
     uint32_t m_height = 0;
     uint32_t m_refreshRate = 0;
-    drmModeModeInfo m_data;
+    drmModeModeInfo m_data = {};
 };
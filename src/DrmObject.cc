@@ -46,21 +46,19 @@ uint32_t DrmObject::type() const
     return m_type;
 }
 
-void DrmObject::forEachProperty(std::function<void(const drmModePropertyPtr, uint64_t)> callback)
+void DrmObject::forEachProperty(std::function<void(const DrmProperty*, uint64_t)> callback)
 {
-    const int fd = m_device->fd();
-
     DrmScopedPointer<drmModeObjectProperties> properties(
-        drmModeObjectGetProperties(fd, m_id, m_type));
+        m_device->getObjectProperties(m_id, m_type));
     if (!properties)
         return;
 
     for (uint32_t i = 0; i < properties->count_props; ++i) {
         const uint32_t propertyId = properties->props[i];
         const uint64_t value = properties->prop_values[i];
-        DrmScopedPointer<drmModePropertyRes> property(drmModeGetProperty(fd, propertyId));
+        const DrmProperty* property = m_device->findProperty(propertyId);
         if (!property)
             continue;
-        callback(property.get(), value);
+        callback(property, value);
     }
 }
@@ -49,8 +49,11 @@ public:
 protected:
     /**
      * Enumerates all properties that this object has.
+     *
+     * Property metadata is shared by all objects of the device, so only the
+     * values are queried from the kernel.
      */
-    void forEachProperty(std::function<void(const drmModePropertyPtr, uint64_t)> callback);
+    void forEachProperty(std::function<void(const DrmProperty*, uint64_t)> callback);
 
 private:
     DrmDevice* m_device;
@@ -17,27 +17,52 @@
  */
 
 #include "DrmOutput.h"
+#include "DrmAllocator.h"
 #include "DrmBlob.h"
 #include "DrmBuffer.h"
 #include "DrmConnector.h"
 #include "DrmCrtc.h"
+#include "DrmCursor.h"
 #include "DrmDevice.h"
+#include "DrmFrameScheduler.h"
+#include "DrmFrameTimeline.h"
 #include "DrmImage.h"
 #include "DrmPlane.h"
+#include "DrmPlaneAssigner.h"
 #include "DrmSwapchain.h"
 
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QVector>
+
 #include <drm_fourcc.h>
 
+#include <algorithm>
+
+#include <unistd.h>
+
 DrmOutput::DrmOutput(DrmConnector* connector, QObject* parent)
     : QObject(parent)
     , m_connector(connector)
     , m_device(connector->device())
 {
+    m_cursor = std::make_unique<DrmCursor>(this);
+    m_planeAssigner = std::make_unique<DrmPlaneAssigner>(this);
+    m_frameScheduler = new DrmFrameScheduler(this, this);
+    m_frameTimeline = std::make_unique<DrmFrameTimeline>();
 }
 
 DrmOutput::~DrmOutput()
 {
+    watchReleaseFence(-1);
     delete m_swapchain;
+
+    // Either the CRTC has been turned off or the device goes away, no page
+    // flip is going to give the images back anymore.
+    for (DrmImage* image : { m_pendingImage, m_submittedImage, m_currentImage }) {
+        if (image)
+            image->release();
+    }
 }
 
 DrmDevice* DrmOutput::device() const
@@ -58,6 +83,24 @@ DrmCrtc* DrmOutput::crtc() const
 void DrmOutput::setCrtc(DrmCrtc* crtc)
 {
     m_crtc = crtc;
+    m_commitTemplate.reset();
+    m_cursor->invalidate();
+    m_planeAssigner->reset();
+}
+
+DrmCursor* DrmOutput::cursor() const
+{
+    return m_cursor.get();
+}
+
+DrmFrameScheduler* DrmOutput::frameScheduler() const
+{
+    return m_frameScheduler;
+}
+
+DrmFrameTimeline* DrmOutput::frameTimeline() const
+{
+    return m_frameTimeline.get();
 }
 
 DrmSwapchain* DrmOutput::swapchain() const
@@ -97,7 +140,13 @@ void DrmOutput::setEnabled(bool enabled)
 
 bool DrmOutput::needsModeset() const
 {
-    return m_needsModeset;
+    if (m_needsModeset || !m_crtc)
+        return m_needsModeset;
+
+    // Only a change of the routing or of the mode, or turning the CRTC on,
+    // requires a modeset. A new frame buffer can be flipped to right away.
+    return m_connector->crtc() != m_crtc || m_crtc->mode() != m_desiredMode
+        || !m_crtc->isActive();
 }
 
 void DrmOutput::setNeedsModeset(bool set)
@@ -112,7 +161,82 @@ DrmMode DrmOutput::desiredMode() const
 
 void DrmOutput::setDesiredMode(const DrmMode& mode)
 {
+    if (m_desiredMode == mode)
+        return;
+
     m_desiredMode = mode;
+    m_modeBlob.reset();
+}
+
+DrmBlob* DrmOutput::modeBlob()
+{
+    if (!m_modeBlob) {
+        const drmModeModeInfo mode = m_desiredMode.data();
+        m_modeBlob = m_device->acquireBlob(&mode, sizeof(mode));
+    }
+
+    return m_modeBlob.get();
+}
+
+int DrmOutput::swapchainDepth() const
+{
+    return m_swapchainDepth;
+}
+
+void DrmOutput::setSwapchainDepth(int depth)
+{
+    m_swapchainDepth = qMax(depth, 2);
+}
+
+QVector<uint64_t> DrmOutput::swapchainModifiers() const
+{
+    return m_swapchainModifiers;
+}
+
+void DrmOutput::setSwapchainModifiers(const QVector<uint64_t>& modifiers)
+{
+    if (m_swapchainModifiers == modifiers)
+        return;
+
+    m_swapchainModifiers = modifiers;
+
+    if (m_swapchain)
+        createSwapchain();
+}
+
+VrrPolicy DrmOutput::vrrPolicy() const
+{
+    return m_vrrPolicy;
+}
+
+void DrmOutput::setVrrPolicy(VrrPolicy policy)
+{
+    if (m_vrrPolicy == policy)
+        return;
+
+    m_vrrPolicy = policy;
+    m_isCommitTemplateDirty = true;
+}
+
+bool DrmOutput::isVrrEnabled() const
+{
+    if (m_vrrPolicy == VrrPolicyNever || !m_crtc)
+        return false;
+
+    if (!m_connector->isVrrCapable() || !m_crtc->supports(DrmCrtc::CapabilityVrr))
+        return false;
+
+    // Content that is scanned out directly, such as a fullscreen game, comes
+    // at its own pace. Otherwise the panel keeps a steady refresh rate.
+    if (m_vrrPolicy == VrrPolicyAutomatic)
+        return directScanoutImage() != nullptr;
+
+    return true;
+}
+
+DrmImage* DrmOutput::currentImage() const
+{
+    return m_currentImage;
 }
 
 DrmImage* DrmOutput::pendingImage() const
@@ -122,9 +246,83 @@ DrmImage* DrmOutput::pendingImage() const
 
 void DrmOutput::setPendingImage(DrmImage* image)
 {
+    // An image that is replaced before it was submitted never reaches the
+    // screen, so the flip handler wouldn't give it back.
+    if (m_pendingImage && m_pendingImage != image && m_pendingImage != m_submittedImage
+        && m_pendingImage != m_currentImage)
+        m_pendingImage->release();
+
     m_pendingImage = image;
 }
 
+bool DrmOutput::isFlipPending() const
+{
+    return m_isFlipPending || (m_isCommitQueued && m_isFrameQueued);
+}
+
+bool DrmOutput::isCommitPending() const
+{
+    return m_isFlipPending || m_isCursorFlipPending || m_isCommitQueued;
+}
+
+bool DrmOutput::pageFlipped(uint sequence, const std::chrono::nanoseconds& timestamp)
+{
+    const bool isFramePresented = m_isFlipPending;
+
+    // The previous image has left the screen and can be reused for rendering.
+    if (m_submittedImage) {
+        if (m_currentImage && m_currentImage != m_submittedImage)
+            m_currentImage->release();
+        m_currentImage = m_submittedImage;
+        m_submittedImage = nullptr;
+        m_frameTimeline->finishFrame(sequence, timestamp);
+    }
+
+    m_cursor->pageFlipped();
+    m_planeAssigner->pageFlipped();
+
+    m_isFlipPending = false;
+    m_isCursorFlipPending = false;
+    m_sequence = sequence;
+    m_timestamp = timestamp;
+
+    return isFramePresented;
+}
+
+QVector<uint64_t> DrmOutput::negotiateModifiers(uint32_t format) const
+{
+    // Until the output is routed, the swapchain has to be usable with any
+    // CRTC that can drive the connector.
+    DrmCrtcList crtcs;
+    if (m_crtc)
+        crtcs << m_crtc;
+    else
+        crtcs = m_connector->possibleCrtcs();
+
+    QVector<uint64_t> modifiers = m_device->allocator()->modifiers(format);
+
+    for (const DrmCrtc* crtc : crtcs) {
+        // Such a CRTC can't show the swapchain anyway.
+        const DrmPlane* plane = crtc->primaryPlane();
+        if (!plane)
+            continue;
+
+        const QVector<uint64_t> supportedModifiers = plane->modifiers(format);
+
+        // Without IN_FORMATS, the layout can only be picked implicitly.
+        if (supportedModifiers.isEmpty())
+            return QVector<uint64_t>();
+
+        auto isUnsupported = [&supportedModifiers](uint64_t modifier) {
+            return !supportedModifiers.contains(modifier);
+        };
+        modifiers.erase(std::remove_if(modifiers.begin(), modifiers.end(), isUnsupported),
+            modifiers.end());
+    }
+
+    return modifiers;
+}
+
 void DrmOutput::createSwapchain()
 {
     destroySwapchain();
@@ -133,42 +331,186 @@ void DrmOutput::createSwapchain()
     const uint32_t height = m_desiredMode.height();
     const uint32_t format = DRM_FORMAT_XRGB8888;
 
-    // TODO: Fill modifiers.
-    const QVector<uint64_t> modifiers;
+    QVector<uint64_t> modifiers = m_swapchainModifiers;
+    if (modifiers.isEmpty())
+        modifiers = negotiateModifiers(format);
 
-    m_swapchain = new DrmSwapchain(m_device, width, height, format, modifiers);
+    m_swapchain = new DrmSwapchain(m_device, width, height, format, modifiers, m_swapchainDepth);
 }
 
 void DrmOutput::destroySwapchain()
 {
+    // A pending image that hasn't been handed to the commit thread won't be
+    // shown anymore. The current and the submitted image stay with the output
+    // until a page flip replaces them, the allocator gets them back then.
+    if (!m_isCommitQueued) {
+        setPendingImage(nullptr);
+        if (m_isFrameQueued)
+            m_frameTimeline->abortFrame();
+        m_isFrameQueued = false;
+    }
+
     delete m_swapchain;
     m_swapchain = nullptr;
 }
 
-void DrmOutput::present()
+static bool canApplyColorCorrection(const DrmCrtc* crtc, const DrmColorCorrection& correction)
 {
-    if (needsModeset()) {
-        const drmModeModeInfo mode = m_desiredMode.data();
-        m_modeBlob = std::make_unique<DrmBlob>(device(), &mode, sizeof(mode));
+    if (!correction.degamma.isEmpty() && !crtc->supports(DrmCrtc::CapabilityDegamma))
+        return false;
+    if (!correction.matrix.isIdentity() && !crtc->supports(DrmCrtc::CapabilityColorMatrix))
+        return false;
+    if (!correction.gamma.isEmpty() && !crtc->supports(DrmCrtc::CapabilityGamma))
+        return false;
+
+    return true;
+}
+
+const DrmColorCorrection& DrmOutput::colorCorrection() const
+{
+    return m_colorCorrection;
+}
+
+bool DrmOutput::setColorCorrection(const DrmColorCorrection& correction)
+{
+    m_colorCorrection = correction;
+    m_isCommitTemplateDirty = true;
+
+    if (m_crtc)
+        m_frameScheduler->scheduleRepaint(QRect(0, 0, m_desiredMode.width(), m_desiredMode.height()));
+
+    return !needsColorCorrectionFallback();
+}
+
+bool DrmOutput::needsColorCorrectionFallback() const
+{
+    if (!m_crtc || m_colorCorrection.isIdentity())
+        return false;
+
+    return !canApplyColorCorrection(m_crtc, m_colorCorrection);
+}
+
+static std::shared_ptr<DrmBlob> createLutBlob(DrmDevice* device, const QVector<QVector3D>& curve,
+    uint32_t size)
+{
+    if (curve.isEmpty() || !size)
+        return nullptr;
+
+    QVector<drm_color_lut> table(size);
+
+    // Resample the curve to the size of the hardware table.
+    for (uint32_t i = 0; i < size; ++i) {
+        const float position = size > 1 ? float(i) * (curve.count() - 1) / (size - 1) : 0;
+        const int index = qMin(int(position), curve.count() - 1);
+        const int nextIndex = qMin(index + 1, curve.count() - 1);
+        const float fraction = position - index;
+
+        const QVector3D value = curve.at(index) * (1 - fraction) + curve.at(nextIndex) * fraction;
+
+        drm_color_lut& entry = table[i];
+        entry.red = uint16_t(qBound(0.0f, value.x(), 1.0f) * 0xffff);
+        entry.green = uint16_t(qBound(0.0f, value.y(), 1.0f) * 0xffff);
+        entry.blue = uint16_t(qBound(0.0f, value.z(), 1.0f) * 0xffff);
+        entry.reserved = 0;
+    }
+
+    auto blob = device->acquireBlob(table.constData(), sizeof(drm_color_lut) * table.count());
+    if (!blob->isValid())
+        return nullptr;
+
+    return blob;
+}
+
+static std::shared_ptr<DrmBlob> createColorMatrixBlob(DrmDevice* device, const QMatrix3x3& matrix)
+{
+    if (matrix.isIdentity())
+        return nullptr;
+
+    // The kernel takes S31.32 sign-magnitude fixed point values, row by row.
+    drm_color_ctm ctm;
+    for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 3; ++column) {
+            const double value = matrix(row, column);
+            uint64_t magnitude = uint64_t(qAbs(value) * (1ull << 32));
+            if (value < 0)
+                magnitude |= 1ull << 63;
+            ctm.matrix[row * 3 + column] = magnitude;
+        }
     }
 
+    auto blob = device->acquireBlob(&ctm, sizeof(ctm));
+    if (!blob->isValid())
+        return nullptr;
+
+    return blob;
+}
+
+void DrmOutput::addColorProperties(drmModeAtomicReq* request)
+{
+    const CrtcProperties& properties = m_crtc->properties();
+    const uint32_t crtcId = m_crtc->id();
+
+    m_degammaBlob.reset();
+    m_colorMatrixBlob.reset();
+    m_gammaBlob.reset();
+
+    // Either the hardware applies the whole correction or none of it, so it
+    // doesn't get applied twice when the renderer has to step in.
+    if (!needsColorCorrectionFallback()) {
+        m_degammaBlob = createLutBlob(m_device, m_colorCorrection.degamma, m_crtc->degammaSize());
+        m_colorMatrixBlob = createColorMatrixBlob(m_device, m_colorCorrection.matrix);
+        m_gammaBlob = createLutBlob(m_device, m_colorCorrection.gamma, m_crtc->gammaSize());
+    }
+
+    // Tables are reset as well, in case someone else has left them behind.
+    if (properties.degammaTable) {
+        const uint32_t blobId = m_degammaBlob ? m_degammaBlob->id() : 0;
+        drmModeAtomicAddProperty(request, crtcId, properties.degammaTable, blobId);
+    }
+    if (properties.colorMatrix) {
+        const uint32_t blobId = m_colorMatrixBlob ? m_colorMatrixBlob->id() : 0;
+        drmModeAtomicAddProperty(request, crtcId, properties.colorMatrix, blobId);
+    }
+    if (properties.gammaTable) {
+        const uint32_t blobId = m_gammaBlob ? m_gammaBlob->id() : 0;
+        drmModeAtomicAddProperty(request, crtcId, properties.gammaTable, blobId);
+    }
+}
+
+void DrmOutput::buildCommitTemplate()
+{
     const DrmPlane* plane = m_crtc->primaryPlane();
     const DrmBuffer* buffer = m_pendingImage->buffer();
 
-    const ConnectorProperties connectorProperties = m_connector->properties();
-    const CrtcProperties crtcProperties = m_crtc->properties();
-    const PlaneProperties planeProperties = plane->properties();
+    const ConnectorProperties& connectorProperties = m_connector->properties();
+    const CrtcProperties& crtcProperties = m_crtc->properties();
+    const PlaneProperties& planeProperties = plane->properties();
 
     const uint32_t connectorId = m_connector->id();
     const uint32_t crtcId = m_crtc->id();
     const uint32_t planeId = plane->id();
 
-    drmModeAtomicReqPtr request = drmModeAtomicAlloc();
+    if (m_commitTemplate)
+        drmModeAtomicSetCursor(m_commitTemplate.get(), 0);
+    else
+        m_commitTemplate.reset(drmModeAtomicAlloc());
 
-    drmModeAtomicAddProperty(request, connectorId, connectorProperties.crtcId, crtcId);
+    drmModeAtomicReq* request = m_commitTemplate.get();
 
-    drmModeAtomicAddProperty(request, crtcId, crtcProperties.modeId, m_modeBlob->id());
-    drmModeAtomicAddProperty(request, crtcId, crtcProperties.active, 1);
+    // The routing and the mode only have to be sent along with a modeset. Once
+    // it has been committed, the template is rebuilt without them.
+    m_isModesetTemplate = needsModeset();
+    if (m_isModesetTemplate) {
+        drmModeAtomicAddProperty(request, connectorId, connectorProperties.crtcId, crtcId);
+        drmModeAtomicAddProperty(request, crtcId, crtcProperties.modeId, modeBlob()->id());
+        drmModeAtomicAddProperty(request, crtcId, crtcProperties.active, 1);
+    }
+
+    addColorProperties(request);
+
+    // The automatic policy decides for every frame, see present().
+    if (crtcProperties.vrrEnabled && m_vrrPolicy != VrrPolicyAutomatic)
+        drmModeAtomicAddProperty(request, crtcId, crtcProperties.vrrEnabled, isVrrEnabled());
 
     drmModeAtomicAddProperty(request, planeId, planeProperties.srcX, 0);
     drmModeAtomicAddProperty(request, planeId, planeProperties.srcY, 0);
@@ -179,13 +521,273 @@ void DrmOutput::present()
     drmModeAtomicAddProperty(request, planeId, planeProperties.crtcWidth, buffer->width());
     drmModeAtomicAddProperty(request, planeId, planeProperties.crtcHeight, buffer->height());
     drmModeAtomicAddProperty(request, planeId, planeProperties.crtcId, crtcId);
-    drmModeAtomicAddProperty(request, planeId, planeProperties.frameBufferId, buffer->id());
 
+    // Everything above stays the same between page flips, only the frame buffer
+    // gets patched in present(). Rewinding the request to this point saves
+    // rebuilding it, but libdrm still copies and sorts the properties on every
+    // commit, and the commit thread works on a duplicate of the request.
+    m_commitTemplateCursor = drmModeAtomicGetCursor(request);
+    m_isCommitTemplateDirty = false;
+}
+
+static std::shared_ptr<DrmBlob> createDamageBlob(DrmDevice* device, const QRegion& damage,
+    const QRect& bounds)
+{
+    const QRegion clipped = damage & bounds;
+
+    // An empty region means that the whole frame buffer has to be updated.
+    if (clipped.isEmpty() || clipped == QRegion(bounds))
+        return nullptr;
+
+    QVector<drm_mode_rect> rects;
+    rects.reserve(clipped.rectCount());
+
+    for (const QRect& rect : clipped) {
+        drm_mode_rect clip;
+        clip.x1 = rect.x();
+        clip.y1 = rect.y();
+        clip.x2 = rect.x() + rect.width();
+        clip.y2 = rect.y() + rect.height();
+        rects << clip;
+    }
+
+    // Damage tends to repeat, e.g. with a blinking cursor, so the blob is
+    // likely to be shared with an earlier frame.
+    auto blob = device->acquireBlob(rects.constData(),
+        sizeof(drm_mode_rect) * rects.count());
+    if (!blob->isValid())
+        return nullptr;
+
+    return blob;
+}
+
+const DrmLayerList& DrmOutput::layers() const
+{
+    return m_layers;
+}
+
+void DrmOutput::setLayers(const DrmLayerList& layers)
+{
+    m_layers = layers;
+}
+
+DrmLayerList DrmOutput::assignPlanes(const DrmLayerList& layers)
+{
+    return m_planeAssigner->assign(layers);
+}
+
+DrmImage* DrmOutput::directScanoutImage() const
+{
+    return m_planeAssigner->directImage();
+}
+
+void DrmOutput::present(const QRegion& damage)
+{
+    if (!m_commitTemplate || m_isCommitTemplateDirty || m_isModesetTemplate != needsModeset())
+        buildCommitTemplate();
+
+    const DrmPlane* plane = m_crtc->primaryPlane();
+    const PlaneProperties& planeProperties = plane->properties();
+    const DrmBuffer* buffer = m_pendingImage->buffer();
+
+    drmModeAtomicReq* request = m_commitTemplate.get();
+    drmModeAtomicSetCursor(request, m_commitTemplateCursor);
+    drmModeAtomicAddProperty(request, plane->id(), planeProperties.frameBufferId, buffer->id());
+
+    // Let the display engine wait for rendering, rather than the CPU.
+    const int renderFence = m_pendingImage->renderFence();
+    if (planeProperties.inFenceFd && renderFence != -1)
+        drmModeAtomicAddProperty(request, plane->id(), planeProperties.inFenceFd, renderFence);
+
+    const CrtcProperties& crtcProperties = m_crtc->properties();
+    if (crtcProperties.vrrEnabled && m_vrrPolicy == VrrPolicyAutomatic)
+        drmModeAtomicAddProperty(request, m_crtc->id(), crtcProperties.vrrEnabled, isVrrEnabled());
+
+    if (crtcProperties.outFencePtr) {
+        const uintptr_t outFence = reinterpret_cast<uintptr_t>(m_crtc->outFenceStorage());
+        drmModeAtomicAddProperty(request, m_crtc->id(), crtcProperties.outFencePtr, outFence);
+    }
+
+    if (planeProperties.damageClips) {
+        const QRect bounds(0, 0, buffer->width(), buffer->height());
+        m_damageBlob = createDamageBlob(m_device, damage, bounds);
+
+        const uint32_t blobId = m_damageBlob ? m_damageBlob->id() : 0;
+        drmModeAtomicAddProperty(request, plane->id(), planeProperties.damageClips, blobId);
+    }
+
+    m_planeAssigner->addProperties(request);
+
+    m_frameCursor = drmModeAtomicGetCursor(request);
+
+    m_swapchain->markPresented(m_pendingImage);
+
+    m_isFrameQueued = true;
+    m_needsCommit = true;
+    m_device->scheduleCommit();
+}
+
+bool DrmOutput::needsCommit() const
+{
+    if (!m_needsCommit)
+        return false;
+    if (m_isFrameQueued)
+        return true;
+
+    // Only the cursor has to be updated. If a frame is about to be rendered,
+    // the update goes along with it. Otherwise the frame would have to wait
+    // for the cursor flip and miss a vblank.
+    return !m_frameScheduler->isRepaintScheduled();
+}
+
+drmModeAtomicReq* DrmOutput::commitRequest()
+{
+    drmModeAtomicReq* request = nullptr;
+
+    if (m_isFrameQueued) {
+        request = m_commitTemplate.get();
+        drmModeAtomicSetCursor(request, m_frameCursor);
+    } else {
+        // Only the cursor has to be updated, don't touch the primary plane.
+        if (!m_cursorRequest)
+            m_cursorRequest.reset(drmModeAtomicAlloc());
+        request = m_cursorRequest.get();
+        drmModeAtomicSetCursor(request, 0);
+    }
+
+    if (m_cursor->needsCommit())
+        m_cursor->addProperties(request);
+
+    return request;
+}
+
+uint32_t DrmOutput::commitFlags() const
+{
     uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
     if (needsModeset())
         flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
 
-    drmModeAtomicCommit(device()->fd(), request, flags, device());
+    return flags;
+}
+
+void DrmOutput::commitQueued()
+{
+    // Nothing else may be committed until the commit thread reports back.
+    m_isCommitQueued = true;
+}
+
+void DrmOutput::commitSubmitted()
+{
+    m_isCommitQueued = false;
+
+    if (m_isFrameQueued) {
+        m_submittedImage = m_pendingImage;
+        m_pendingImage = nullptr;
+        m_submittedImage->setRenderFence(-1);
+        m_planeAssigner->commitSubmitted();
+
+        // Remember what the hardware does now, to tell later whether a modeset
+        // is needed.
+        m_connector->setCrtc(m_crtc);
+        m_crtc->setMode(m_desiredMode);
+        m_crtc->setActive(true);
+        setNeedsModeset(false);
+
+        // The out-fence signals once the new image has replaced the one on
+        // the screen. The latter can go back to its swapchain then, without
+        // waiting for the page flip event to be dispatched.
+        watchReleaseFence(m_crtc->takeOutFence());
+    }
+
+    m_cursor->commitSubmitted();
+
+    // A cursor update has to complete before the next commit too, but it
+    // doesn't hold back rendering.
+    if (m_isFrameQueued)
+        m_isFlipPending = true;
+    else
+        m_isCursorFlipPending = true;
+
+    m_isFrameQueued = false;
+    m_needsCommit = false;
+}
+
+void DrmOutput::commitFailed()
+{
+    m_isCommitQueued = false;
+
+    if (m_isFrameQueued && m_pendingImage) {
+        m_pendingImage->setRenderFence(-1);
+        m_pendingImage->release();
+        m_pendingImage = nullptr;
+    }
+
+    if (m_isFrameQueued && m_crtc) {
+        const int outFence = m_crtc->takeOutFence();
+        if (outFence != -1)
+            close(outFence);
+    }
+
+    if (m_isFrameQueued)
+        m_frameTimeline->abortFrame();
+
+    // A flip relies on what the hardware is believed to be doing, which may be
+    // wrong, e.g. if another master has changed it. Fall back to a modeset.
+    if (m_isFrameQueued && !m_isModesetTemplate)
+        setNeedsModeset(true);
+
+    m_cursor->commitFailed();
+
+    m_isFrameQueued = false;
+    m_needsCommit = false;
+
+    // A cursor update that didn't make it is retried a refresh cycle later, if
+    // no frame has picked it up in the meantime.
+    if (m_cursor->needsCommit()) {
+        const auto interval = std::chrono::duration_cast<std::chrono::milliseconds>(
+            m_frameScheduler->refreshInterval());
+        QTimer::singleShot(interval.count() + 1, this, &DrmOutput::scheduleCursorUpdate);
+    }
+}
+
+void DrmOutput::watchReleaseFence(int fd)
+{
+    if (m_releaseNotifier) {
+        m_releaseNotifier->setEnabled(false);
+        m_releaseNotifier->deleteLater();
+        m_releaseNotifier = nullptr;
+        close(m_releaseFence);
+        m_releaseFence = -1;
+    }
+
+    if (fd == -1)
+        return;
+
+    m_releaseFence = fd;
+    m_releaseNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(m_releaseNotifier, &QSocketNotifier::activated, this, &DrmOutput::releaseFenceSignaled);
+}
+
+void DrmOutput::releaseFenceSignaled()
+{
+    watchReleaseFence(-1);
+
+    // The page flip may have been handled already, it has released the image.
+    if (m_submittedImage && m_currentImage && m_currentImage != m_submittedImage) {
+        m_currentImage->release();
+        m_currentImage = nullptr;
+    }
+}
+
+void DrmOutput::scheduleCursorUpdate()
+{
+    if (!m_cursor->needsCommit())
+        return;
+
+    // The cursor goes out along with the first frame after a modeset.
+    if (!m_crtc || needsModeset())
+        return;
 
-    drmModeAtomicFree(request);
+    m_needsCommit = true;
+    m_device->scheduleCommit();
 }
@@ -20,12 +20,18 @@
 
 #include "globals.h"
 
+#include "DrmColorCorrection.h"
+#include "DrmLayer.h"
 #include "DrmMode.h"
+#include "DrmPointer.h"
 
 #include <QObject>
+#include <QRegion>
 
 #include <memory>
 
+class QSocketNotifier;
+
 class DrmOutput : public QObject {
     Q_OBJECT
 
@@ -53,6 +59,21 @@ public:
      */
     void setCrtc(DrmCrtc* crtc);
 
+    /**
+     * Returns the hardware cursor of this output.
+     */
+    DrmCursor* cursor() const;
+
+    /**
+     * Returns the frame scheduler of this output.
+     */
+    DrmFrameScheduler* frameScheduler() const;
+
+    /**
+     * Returns the timings of recent frames of this output.
+     */
+    DrmFrameTimeline* frameTimeline() const;
+
     /**
      * Returns the swapchain of this output.
      */
@@ -90,11 +111,14 @@ public:
 
     /**
      * Returns whether this output needs a modeset.
+     *
+     * A modeset is needed if the desired mode or routing differs from what the
+     * hardware currently does, or if it has been forced with setNeedsModeset().
      */
     bool needsModeset() const;
 
     /**
-     * Sets whether this output needs to perform modesetting.
+     * Forces a modeset, e.g. because the state of the hardware is unknown.
      */
     void setNeedsModeset(bool set);
 
@@ -108,38 +132,211 @@ public:
      */
     void setDesiredMode(const DrmMode& mode);
 
+    /**
+     * Returns the property blob that holds the desired mode.
+     */
+    DrmBlob* modeBlob();
+
+    /**
+     * Returns the number of images in the swapchain.
+     */
+    int swapchainDepth() const;
+
+    /**
+     * Sets the number of images in the swapchain.
+     *
+     * Two images give the lowest latency, while more images leave more room
+     * for jitter in rendering times. The new depth takes effect the next time
+     * the swapchain is created.
+     */
+    void setSwapchainDepth(int depth);
+
+    /**
+     * Returns the layouts that the swapchain is restricted to.
+     */
+    QVector<uint64_t> swapchainModifiers() const;
+
+    /**
+     * Restricts the layouts of the swapchain images to the given @p modifiers.
+     *
+     * An empty list lets the output negotiate the layout with the display
+     * engine, which is the default. An existing swapchain is recreated.
+     */
+    void setSwapchainModifiers(const QVector<uint64_t>& modifiers);
+
+    /**
+     * Returns the color correction of this output.
+     */
+    const DrmColorCorrection& colorCorrection() const;
+
+    /**
+     * Sets the color correction. The display engine starts applying it with
+     * the next frame.
+     *
+     * If the CRTC can't apply the whole correction, @c false is returned. The
+     * renderer has to apply it then, see needsColorCorrectionFallback().
+     */
+    bool setColorCorrection(const DrmColorCorrection& correction);
+
+    /**
+     * Returns whether the renderer has to apply the color correction because
+     * the CRTC can't.
+     */
+    bool needsColorCorrectionFallback() const;
+
+    /**
+     * Returns the variable refresh rate policy.
+     */
+    VrrPolicy vrrPolicy() const;
+
+    /**
+     * Sets the variable refresh rate policy. It takes effect with the next
+     * frame.
+     */
+    void setVrrPolicy(VrrPolicy policy);
+
+    /**
+     * Returns whether the refresh rate follows the frames, i.e. the policy
+     * asks for it and both the display and the CRTC support it.
+     *
+     * With the automatic policy, this is only the case while the last frame
+     * has been scanned out directly, see directScanoutImage().
+     */
+    bool isVrrEnabled() const;
+
+    /**
+     * Returns the image that is currently on the screen.
+     */
+    DrmImage* currentImage() const;
+
     /**
      * Returns image about to be presented.
      */
     DrmImage* pendingImage() const;
 
     /**
-     * Sets an image about to be presented.
+     * Sets an image about to be presented. A previous pending image that
+     * hasn't been presented yet is put back to its swapchain.
      */
     void setPendingImage(DrmImage* image);
 
     /**
+     * Returns whether a frame for this output has been submitted and the
+     * corresponding page flip hasn't completed yet. Cursor updates are not
+     * taken into account.
+     */
+    bool isFlipPending() const;
+
+    /**
+     * Notifies the output that the submitted commit has been applied.
      *
+     * Returns @c true if the commit carried a frame, and @c false if it only
+     * updated the cursor.
      */
-    void present();
+    bool pageFlipped(uint sequence, const std::chrono::nanoseconds& timestamp);
+
+    /**
+     * Returns the layers that make up the contents of this output.
+     */
+    const DrmLayerList& layers() const;
+
+    /**
+     * Sets the layers that make up the contents of this output, ordered from
+     * bottom to top. They are shown starting with the next frame.
+     */
+    void setLayers(const DrmLayerList& layers);
+
+    /**
+     * Puts as many of the given @p layers as possible on hardware planes.
+     *
+     * The layers are ordered from bottom to top. The returned layers have to be
+     * composited into the pending image before calling present(). If the bottom
+     * layer can be scanned out directly, see directScanoutImage().
+     */
+    DrmLayerList assignPlanes(const DrmLayerList& layers);
+
+    /**
+     * Returns the image that the last assignPlanes() has put on the primary
+     * plane, or @c null if the layers have to be composited.
+     *
+     * The image is presented as it is, no image has to be acquired from the
+     * swapchain for the frame.
+     */
+    DrmImage* directScanoutImage() const;
+
+    /**
+     * Queues the pending image for presentation.
+     *
+     * The @p damage describes the area that changed since the previous frame,
+     * drivers that support damage clips transfer only that area. An empty
+     * region means that the whole image has changed.
+     *
+     * The image is not committed right away, the device batches pending state
+     * of all its outputs into a single atomic commit.
+     */
+    void present(const QRegion& damage = QRegion());
 
 private:
+    QVector<uint64_t> negotiateModifiers(uint32_t format) const;
     void createSwapchain();
     void destroySwapchain();
+    void buildCommitTemplate();
+    void addColorProperties(drmModeAtomicReq* request);
+
+    bool needsCommit() const;
+    bool isCommitPending() const;
+    drmModeAtomicReq* commitRequest();
+    uint32_t commitFlags() const;
+    void commitQueued();
+    void commitSubmitted();
+    void commitFailed();
+    void watchReleaseFence(int fd);
+    void releaseFenceSignaled();
+    void scheduleCursorUpdate();
 
     DrmMode m_desiredMode;
+    DrmColorCorrection m_colorCorrection;
+    DrmLayerList m_layers;
+    QVector<uint64_t> m_swapchainModifiers;
+    VrrPolicy m_vrrPolicy = VrrPolicyNever;
     DrmConnector* m_connector = nullptr;
     DrmCrtc* m_crtc = nullptr;
     DrmDevice* m_device = nullptr;
+    DrmFrameScheduler* m_frameScheduler = nullptr;
     DrmSwapchain* m_swapchain = nullptr;
+    DrmImage* m_currentImage = nullptr;
+    DrmImage* m_submittedImage = nullptr;
     DrmImage* m_pendingImage = nullptr;
-    std::unique_ptr<DrmBlob> m_modeBlob;
+    std::shared_ptr<DrmBlob> m_modeBlob;
+    std::shared_ptr<DrmBlob> m_damageBlob;
+    std::shared_ptr<DrmBlob> m_degammaBlob;
+    std::shared_ptr<DrmBlob> m_colorMatrixBlob;
+    std::shared_ptr<DrmBlob> m_gammaBlob;
+    std::unique_ptr<DrmCursor> m_cursor;
+    std::unique_ptr<DrmFrameTimeline> m_frameTimeline;
+    std::unique_ptr<DrmPlaneAssigner> m_planeAssigner;
+    DrmScopedPointer<drmModeAtomicReq> m_commitTemplate;
+    DrmScopedPointer<drmModeAtomicReq> m_cursorRequest;
+    QSocketNotifier* m_releaseNotifier = nullptr;
+    int m_releaseFence = -1;
+    int m_commitTemplateCursor = 0;
+    int m_frameCursor = 0;
     std::chrono::nanoseconds m_timestamp;
     uint m_sequence = 0;
+    int m_swapchainDepth = 3;
     bool m_isEnabled = false;
     bool m_needsModeset = false;
+    bool m_isCommitTemplateDirty = false;
+    bool m_isModesetTemplate = false;
+    bool m_needsCommit = false;
+    bool m_isFrameQueued = false;
+    bool m_isFlipPending = false;
+    bool m_isCursorFlipPending = false;
+    bool m_isCommitQueued = false;
 
+    friend class DrmCursor;
     friend class DrmDevice;
+    friend class DrmPlaneAssigner;
 
     Q_DISABLE_COPY(DrmOutput)
 };
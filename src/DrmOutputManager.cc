@@ -18,6 +18,7 @@
 
 #include "DrmOutputManager.h"
 #include "DrmConnector.h"
+#include "DrmCrtc.h"
 #include "DrmOutput.h"
 
 DrmOutputManager::DrmOutputManager(QObject* parent)
@@ -34,11 +35,62 @@ bool DrmOutputManager::isValid() const
     return true;
 }
 
+static DrmMode findInitialMode(const DrmConnector* connector)
+{
+    // Keep the mode that the firmware has set, so the output doesn't go
+    // blank on startup.
+    if (const DrmCrtc* crtc = connector->crtc()) {
+        const DrmMode currentMode = crtc->mode();
+        for (const DrmMode& mode : connector->modes()) {
+            if (mode == currentMode)
+                return mode;
+        }
+    }
+
+    return connector->preferredMode();
+}
+
+static VrrPolicy parseVrrPolicy(const QByteArray& value, VrrPolicy fallback)
+{
+    if (value == QByteArrayLiteral("never") || value == QByteArrayLiteral("0"))
+        return VrrPolicyNever;
+    if (value == QByteArrayLiteral("always") || value == QByteArrayLiteral("1"))
+        return VrrPolicyAlways;
+    if (value == QByteArrayLiteral("automatic"))
+        return VrrPolicyAutomatic;
+
+    return fallback;
+}
+
+static VrrPolicy findVrrPolicy(const DrmConnector* connector)
+{
+    // DRM_PLAYGROUND_VRR holds the policy of all outputs, and optionally the
+    // policies of single connectors, e.g. "automatic,DP-1=always".
+    const QList<QByteArray> entries = qgetenv("DRM_PLAYGROUND_VRR").split(',');
+    const QByteArray name = connector->name().toUtf8();
+
+    VrrPolicy policy = VrrPolicyNever;
+    for (const QByteArray& entry : entries) {
+        if (!entry.contains('='))
+            policy = parseVrrPolicy(entry.trimmed(), policy);
+    }
+
+    for (const QByteArray& entry : entries) {
+        const int separator = entry.indexOf('=');
+        if (separator != -1 && entry.left(separator).trimmed() == name)
+            policy = parseVrrPolicy(entry.mid(separator + 1).trimmed(), policy);
+    }
+
+    return policy;
+}
+
 void DrmOutputManager::prepare(DrmOutput* output)
 {
     const DrmConnector* connector = output->connector();
 
-    output->setDesiredMode(connector->preferredMode());
+    output->setDesiredMode(findInitialMode(connector));
     output->setEnabled(true);
-    output->setNeedsModeset(true);
+    output->setVrrPolicy(findVrrPolicy(connector));
+
+    emit outputPrepared(output);
 }
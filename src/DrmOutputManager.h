@@ -39,6 +39,13 @@ public:
      */
     void prepare(DrmOutput* output);
 
+signals:
+    /**
+     * This signal is emitted when the initial state of an output has been
+     * prepared, before the output is lit up.
+     */
+    void outputPrepared(DrmOutput* output);
+
 private:
     Q_DISABLE_COPY(DrmOutputManager)
 };
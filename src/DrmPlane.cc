@@ -19,11 +19,26 @@
 #include "DrmPlane.h"
 #include "DrmDevice.h"
 #include "DrmPointer.h"
-
-static PlaneType findPlaneType(const drmModePropertyPtr property, uint64_t value)
+#include "DrmProperty.h"
+
+static const DrmPropertyBinding<PlaneProperties> planeBindings[] = {
+    { "CRTC_H", &PlaneProperties::crtcHeight },
+    { "CRTC_ID", &PlaneProperties::crtcId },
+    { "CRTC_W", &PlaneProperties::crtcWidth },
+    { "CRTC_X", &PlaneProperties::crtcX },
+    { "CRTC_Y", &PlaneProperties::crtcY },
+    { "FB_DAMAGE_CLIPS", &PlaneProperties::damageClips },
+    { "FB_ID", &PlaneProperties::frameBufferId },
+    { "IN_FENCE_FD", &PlaneProperties::inFenceFd },
+    { "SRC_H", &PlaneProperties::srcHeight },
+    { "SRC_W", &PlaneProperties::srcWidth },
+    { "SRC_X", &PlaneProperties::srcX },
+    { "SRC_Y", &PlaneProperties::srcY },
+};
+
+static PlaneType findPlaneType(const DrmProperty* property, uint64_t value)
 {
-    for (int i = 0; i < property->count_enums; ++i) {
-        const drm_mode_property_enum& enumerator = property->enums[i];
+    for (const drm_mode_property_enum& enumerator : property->enums) {
         if (enumerator.value != value)
             continue;
         if (enumerator.name == QByteArrayLiteral("Primary"))
@@ -79,66 +94,30 @@ static QVector<drm_format_modifier> parseModifiers(const uint8_t* data)
 DrmPlane::DrmPlane(DrmDevice* device, uint32_t id)
     : DrmObject(device, id, DRM_MODE_OBJECT_PLANE)
 {
-    const int fd = device->fd();
-
-    DrmScopedPointer<drmModePlane> plane(drmModeGetPlane(fd, id));
+    DrmScopedPointer<drmModePlane> plane(device->getPlane(id));
     if (!plane)
         return;
 
-    forEachProperty([=](const drmModePropertyPtr property, uint64_t value) {
-        if (property->name == QByteArrayLiteral("CRTC_X")) {
-            m_properties.crtcX = property->prop_id;
-            return;
-        }
-        if (property->name == QByteArrayLiteral("CRTC_Y")) {
-            m_properties.crtcY = property->prop_id;
+    forEachProperty([=](const DrmProperty* property, uint64_t value) {
+        if (bindProperty(planeBindings, property, m_properties))
             return;
-        }
-        if (property->name == QByteArrayLiteral("CRTC_W")) {
-            m_properties.crtcWidth = property->prop_id;
-            return;
-        }
-        if (property->name == QByteArrayLiteral("CRTC_H")) {
-            m_properties.crtcHeight = property->prop_id;
-            return;
-        }
-        if (property->name == QByteArrayLiteral("CRTC_ID")) {
-            m_properties.crtcId = property->prop_id;
-            return;
-        }
-        if (property->name == QByteArrayLiteral("FB_ID")) {
-            m_properties.frameBufferId = property->prop_id;
-            return;
-        }
         if (property->name == QByteArrayLiteral("IN_FORMATS")) {
             const uint32_t id = uint32_t(value);
-            DrmScopedPointer<drmModePropertyBlobRes> blob(drmModeGetPropertyBlob(fd, id));
+            DrmScopedPointer<drmModePropertyBlobRes> blob(device->getPropertyBlob(id));
             if (!blob)
                 return;
             m_formats = parseFormats(static_cast<uint8_t*>(blob->data));
             m_modifiers = parseModifiers(static_cast<uint8_t*>(blob->data));
             return;
         }
-        if (property->name == QByteArrayLiteral("SRC_X")) {
-            m_properties.srcX = property->prop_id;
-            return;
-        }
-        if (property->name == QByteArrayLiteral("SRC_Y")) {
-            m_properties.srcY = property->prop_id;
-            return;
-        }
-        if (property->name == QByteArrayLiteral("SRC_W")) {
-            m_properties.srcWidth = property->prop_id;
-            return;
-        }
-        if (property->name == QByteArrayLiteral("SRC_H")) {
-            m_properties.srcHeight = property->prop_id;
-            return;
-        }
         if (property->name == QByteArrayLiteral("type")) {
             m_type = findPlaneType(property, value);
             return;
         }
+        if (property->name == QByteArrayLiteral("zpos")) {
+            m_zpos = int(value);
+            return;
+        }
     });
 
     m_possibleCrtcs = device->findCrtcs(plane->possible_crtcs);
@@ -167,12 +146,12 @@ void DrmPlane::setCrtc(DrmCrtc* crtc)
     m_crtc = crtc;
 }
 
-DrmCrtcList DrmPlane::possibleCrtcs() const
+const DrmCrtcList& DrmPlane::possibleCrtcs() const
 {
     return m_possibleCrtcs;
 }
 
-QVector<uint32_t> DrmPlane::formats() const
+const QVector<uint32_t>& DrmPlane::formats() const
 {
     return m_formats;
 }
@@ -193,7 +172,12 @@ QVector<uint64_t> DrmPlane::modifiers(uint32_t format) const
     return modifiers;
 }
 
-PlaneProperties DrmPlane::properties() const
+int DrmPlane::zpos() const
+{
+    return m_zpos;
+}
+
+const PlaneProperties& DrmPlane::properties() const
 {
     return m_properties;
 }
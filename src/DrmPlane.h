@@ -34,6 +34,10 @@ struct PlaneProperties {
     uint32_t srcY = 0;
     uint32_t srcWidth = 0;
     uint32_t srcHeight = 0;
+
+    // Optional properties, not all drivers provide them.
+    uint32_t damageClips = 0;
+    uint32_t inFenceFd = 0;
 };
 
 class DrmPlane : public DrmObject {
@@ -59,12 +63,12 @@ public:
     /**
      * Returns a list of possible CRTCs this plane can be attached to.
      */
-    DrmCrtcList possibleCrtcs() const;
+    const DrmCrtcList& possibleCrtcs() const;
 
     /**
      * Returns supported formats.
      */
-    QVector<uint32_t> formats() const;
+    const QVector<uint32_t>& formats() const;
 
     /**
      * Returns modifiers for the given format.
@@ -72,15 +76,22 @@ public:
     QVector<uint64_t> modifiers(uint32_t format) const;
 
     /**
-     *
+     * Returns the position of this plane in the stacking order, or -1 if
+     * the driver doesn't expose it.
+     */
+    int zpos() const;
+
+    /**
+     * Returns ids of the properties of this plane.
      */
-    PlaneProperties properties() const;
+    const PlaneProperties& properties() const;
 
 private:
     PlaneType m_type;
     PlaneProperties m_properties;
     DrmCrtcList m_possibleCrtcs;
     DrmCrtc* m_crtc;
+    int m_zpos = -1;
 
     QVector<uint32_t> m_formats;
     QVector<drm_format_modifier> m_modifiers;
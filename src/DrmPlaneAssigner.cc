@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DrmPlaneAssigner.h"
+#include "DrmBuffer.h"
+#include "DrmCrtc.h"
+#include "DrmDevice.h"
+#include "DrmImage.h"
+#include "DrmOutput.h"
+#include "DrmPlane.h"
+#include "DrmSwapchain.h"
+
+#include <drm_fourcc.h>
+
+#include <algorithm>
+
+static bool supportsBuffer(const DrmPlane* plane, const DrmBuffer* buffer)
+{
+    if (!buffer)
+        return false;
+
+    const uint32_t format = buffer->format();
+    if (!plane->formats().contains(format))
+        return false;
+
+    // The layout is up to the driver, there is nothing to check.
+    const uint64_t modifier = buffer->modifier();
+    if (modifier == DRM_FORMAT_MOD_INVALID)
+        return true;
+
+    const QVector<uint64_t> modifiers = plane->modifiers(format);
+    if (modifiers.isEmpty())
+        return modifier == DRM_FORMAT_MOD_LINEAR;
+
+    return modifiers.contains(modifier);
+}
+
+static bool isFullscreen(const DrmLayer& layer, const QRect& outputRect)
+{
+    const DrmBuffer* buffer = layer.image->buffer();
+    const QRect bufferRect(0, 0, buffer->width(), buffer->height());
+
+    return layer.isOpaque
+        && layer.targetRect == outputRect
+        && layer.sourceRect == bufferRect
+        && bufferRect.size() == outputRect.size();
+}
+
+static void addPlaneProperties(drmModeAtomicReq* request, const DrmPlane* plane,
+    const DrmCrtc* crtc, const DrmLayer& layer)
+{
+    const PlaneProperties& properties = plane->properties();
+    const uint32_t planeId = plane->id();
+
+    const QRect& source = layer.sourceRect;
+    const QRect& target = layer.targetRect;
+
+    drmModeAtomicAddProperty(request, planeId, properties.srcX, static_cast<uint64_t>(source.x()) << 16);
+    drmModeAtomicAddProperty(request, planeId, properties.srcY, static_cast<uint64_t>(source.y()) << 16);
+    drmModeAtomicAddProperty(request, planeId, properties.srcWidth, static_cast<uint64_t>(source.width()) << 16);
+    drmModeAtomicAddProperty(request, planeId, properties.srcHeight, static_cast<uint64_t>(source.height()) << 16);
+    drmModeAtomicAddProperty(request, planeId, properties.crtcX, static_cast<int64_t>(target.x()));
+    drmModeAtomicAddProperty(request, planeId, properties.crtcY, static_cast<int64_t>(target.y()));
+    drmModeAtomicAddProperty(request, planeId, properties.crtcWidth, target.width());
+    drmModeAtomicAddProperty(request, planeId, properties.crtcHeight, target.height());
+    drmModeAtomicAddProperty(request, planeId, properties.crtcId, crtc->id());
+    drmModeAtomicAddProperty(request, planeId, properties.frameBufferId, layer.image->buffer()->id());
+}
+
+static void disablePlane(drmModeAtomicReq* request, const DrmPlane* plane)
+{
+    const PlaneProperties& properties = plane->properties();
+
+    drmModeAtomicAddProperty(request, plane->id(), properties.crtcId, 0);
+    drmModeAtomicAddProperty(request, plane->id(), properties.frameBufferId, 0);
+}
+
+DrmPlaneAssigner::DrmPlaneAssigner(DrmOutput* output)
+    : m_output(output)
+{
+}
+
+DrmPlaneAssigner::~DrmPlaneAssigner()
+{
+}
+
+DrmLayerList DrmPlaneAssigner::assign(const DrmLayerList& layers)
+{
+    m_pending.clear();
+    m_directImage = nullptr;
+
+    // Nothing can be tested until the output has been lit up.
+    const DrmCrtc* crtc = m_output->crtc();
+    if (!crtc || !m_output->m_commitTemplate || m_output->needsModeset())
+        return layers;
+
+    if (layers.isEmpty())
+        return layers;
+
+    const DrmPlaneList planes = availablePlanes();
+
+    // Overlays are stacked above the primary plane, so only the topmost layers
+    // can be lifted onto them. The bottom layer always goes to the primary plane.
+    int composited = layers.count();
+    for (int i = planes.count() - 1; i >= 0 && composited > 1; --i) {
+        const DrmLayer& layer = layers.at(composited - 1);
+        if (!layer.image || !supportsBuffer(planes.at(i), layer.image->buffer()))
+            break;
+
+        m_pending.prepend({ planes.at(i), layer });
+        composited--;
+    }
+
+    // A single fullscreen layer underneath doesn't need to be composited.
+    const DrmMode mode = m_output->desiredMode();
+    const QRect outputRect(0, 0, mode.width(), mode.height());
+
+    DrmImage* directImage = nullptr;
+    if (composited == 1) {
+        const DrmLayer& layer = layers.first();
+        if (layer.image && isFullscreen(layer, outputRect)
+            && supportsBuffer(crtc->primaryPlane(), layer.image->buffer()))
+            directImage = layer.image;
+    }
+
+    // Move layers back to composition until the hardware accepts the configuration.
+    while (!test(directImage)) {
+        if (directImage) {
+            directImage = nullptr;
+            continue;
+        }
+
+        if (m_pending.isEmpty())
+            return layers;
+
+        m_pending.removeFirst();
+        composited++;
+    }
+
+    // The swapchain isn't touched here, the frame scheduler presents the
+    // image instead of acquiring one.
+    if (directImage) {
+        m_directImage = directImage;
+        return DrmLayerList();
+    }
+
+    return layers.mid(0, composited);
+}
+
+DrmImage* DrmPlaneAssigner::directImage() const
+{
+    return m_directImage;
+}
+
+DrmPlaneList DrmPlaneAssigner::availablePlanes() const
+{
+    DrmCrtc* crtc = m_output->crtc();
+
+    DrmPlaneList planes;
+    for (DrmPlane* plane : m_output->device()->planes(PlaneOverlay)) {
+        if (plane->crtc() && plane->crtc() != crtc)
+            continue;
+        if (!plane->possibleCrtcs().contains(crtc))
+            continue;
+        planes << plane;
+    }
+
+    // Without zpos, the stacking order of overlays is unknown.
+    const bool hasStackingOrder = std::all_of(planes.begin(), planes.end(),
+        [](const DrmPlane* plane) { return plane->zpos() != -1; });
+    if (!hasStackingOrder)
+        return planes.mid(0, 1);
+
+    // Overlays underneath the primary plane would be hidden by it.
+    const int primaryZpos = crtc->primaryPlane()->zpos();
+    if (primaryZpos != -1) {
+        auto isBelowPrimary = [primaryZpos](const DrmPlane* plane) {
+            return plane->zpos() <= primaryZpos;
+        };
+        planes.erase(std::remove_if(planes.begin(), planes.end(), isBelowPrimary), planes.end());
+    }
+
+    std::stable_sort(planes.begin(), planes.end(), [](const DrmPlane* a, const DrmPlane* b) {
+        return a->zpos() < b->zpos();
+    });
+
+    return planes;
+}
+
+const DrmBuffer* DrmPlaneAssigner::findPrimaryBuffer(const DrmImage* directImage) const
+{
+    if (directImage)
+        return directImage->buffer();
+
+    if (const DrmImage* image = m_output->currentImage())
+        return image->buffer();
+
+    const DrmSwapchain* swapchain = m_output->swapchain();
+    if (!swapchain || !swapchain->isValid())
+        return nullptr;
+
+    return swapchain->images().first()->buffer();
+}
+
+bool DrmPlaneAssigner::test(const DrmImage* directImage)
+{
+    const DrmBuffer* primaryBuffer = findPrimaryBuffer(directImage);
+    if (!primaryBuffer)
+        return false;
+
+    if (m_testRequest)
+        drmModeAtomicSetCursor(m_testRequest.get(), 0);
+    else
+        m_testRequest.reset(drmModeAtomicAlloc());
+
+    drmModeAtomicReq* request = m_testRequest.get();
+
+    // Start with the static state of the output and put the candidates on top.
+    drmModeAtomicReq* state = m_output->m_commitTemplate.get();
+    drmModeAtomicSetCursor(state, m_output->m_commitTemplateCursor);
+    drmModeAtomicMerge(request, state);
+
+    const DrmPlane* primaryPlane = m_output->crtc()->primaryPlane();
+    drmModeAtomicAddProperty(request, primaryPlane->id(),
+        primaryPlane->properties().frameBufferId, primaryBuffer->id());
+
+    addProperties(request);
+
+    DrmDevice* device = m_output->device();
+    return device->commit(request, DRM_MODE_ATOMIC_TEST_ONLY, { m_output->crtc() });
+}
+
+void DrmPlaneAssigner::addProperties(drmModeAtomicReq* request) const
+{
+    const DrmCrtc* crtc = m_output->crtc();
+
+    for (const Assignment& assignment : m_pending)
+        addPlaneProperties(request, assignment.plane, crtc, assignment.layer);
+
+    // Planes that were used in the previous frames have to be turned off.
+    for (const DrmPlane* plane : m_claimedPlanes) {
+        const bool isUsed = std::any_of(m_pending.begin(), m_pending.end(),
+            [plane](const Assignment& assignment) { return assignment.plane == plane; });
+        if (!isUsed)
+            disablePlane(request, plane);
+    }
+}
+
+void DrmPlaneAssigner::commitSubmitted()
+{
+    for (DrmPlane* plane : m_claimedPlanes)
+        plane->setCrtc(nullptr);
+
+    m_claimedPlanes.clear();
+    m_submitted = m_pending;
+
+    for (const Assignment& assignment : m_pending) {
+        assignment.plane->setCrtc(m_output->crtc());
+        m_claimedPlanes << assignment.plane;
+    }
+}
+
+void DrmPlaneAssigner::pageFlipped()
+{
+    // Release images that have left the screen.
+    for (const Assignment& current : m_current) {
+        const bool isShown = std::any_of(m_submitted.begin(), m_submitted.end(),
+            [&current](const Assignment& submitted) { return submitted.layer.image == current.layer.image; });
+        if (!isShown)
+            current.layer.image->release();
+    }
+
+    m_current = m_submitted;
+}
+
+void DrmPlaneAssigner::reset()
+{
+    // Claimed planes stay claimed, so they get turned off with the next frame.
+    m_pending.clear();
+    m_directImage = nullptr;
+}
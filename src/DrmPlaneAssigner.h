@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "globals.h"
+
+#include "DrmLayer.h"
+#include "DrmPointer.h"
+
+class DrmPlaneAssigner {
+public:
+    explicit DrmPlaneAssigner(DrmOutput* output);
+    ~DrmPlaneAssigner();
+
+    /**
+     * Assigns the given @p layers, ordered from bottom to top, to hardware planes.
+     *
+     * Layers that can't be put on planes are returned, they have to be composited
+     * by the renderer into an image of the swapchain. If no layers are returned,
+     * the bottom layer is scanned out directly from the primary plane and the
+     * renderer can be skipped altogether, see directImage().
+     */
+    DrmLayerList assign(const DrmLayerList& layers);
+
+    /**
+     * Returns the image that is scanned out directly from the primary plane,
+     * or @c null if the layers have to be composited.
+     */
+    DrmImage* directImage() const;
+
+private:
+    struct Assignment {
+        DrmPlane* plane;
+        DrmLayer layer;
+    };
+
+    DrmPlaneList availablePlanes() const;
+    const DrmBuffer* findPrimaryBuffer(const DrmImage* directImage) const;
+    bool test(const DrmImage* directImage);
+    void addProperties(drmModeAtomicReq* request) const;
+    void commitSubmitted();
+    void pageFlipped();
+    void reset();
+
+    DrmOutput* m_output;
+    DrmScopedPointer<drmModeAtomicReq> m_testRequest;
+    QVector<Assignment> m_pending;
+    QVector<Assignment> m_submitted;
+    QVector<Assignment> m_current;
+    DrmPlaneList m_claimedPlanes;
+    DrmImage* m_directImage = nullptr;
+
+    friend class DrmOutput;
+};
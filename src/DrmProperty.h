@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "globals.h"
+
+#include <QByteArray>
+#include <QVector>
+
+#include <xf86drmMode.h>
+
+/**
+ * Metadata of a property, it doesn't change during the lifetime of the device.
+ */
+struct DrmProperty {
+    uint32_t id = 0;
+    uint32_t flags = 0;
+    QByteArray name;
+    QVector<uint64_t> values;
+    QVector<drm_mode_property_enum> enums;
+};
+
+/**
+ * Binds the name of a property to the field that holds its id.
+ */
+template <typename T>
+struct DrmPropertyBinding {
+    const char* name;
+    uint32_t T::*field;
+};
+
+/**
+ * Stores the id of the @p property in the field of @p properties that it is
+ * bound to. Returns @c false if the property is not in the @p bindings.
+ */
+template <typename T, size_t N>
+bool bindProperty(const DrmPropertyBinding<T> (&bindings)[N], const DrmProperty* property,
+    T& properties)
+{
+    for (const DrmPropertyBinding<T>& binding : bindings) {
+        if (property->name == binding.name) {
+            properties.*binding.field = property->id;
+            return true;
+        }
+    }
+
+    return false;
+}
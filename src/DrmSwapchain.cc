@@ -18,24 +18,58 @@
 
 #include "DrmSwapchain.h"
 #include "DrmAllocator.h"
+#include "DrmBuffer.h"
 #include "DrmDevice.h"
 #include "DrmImage.h"
 
+#include <drm_fourcc.h>
+
 DrmSwapchain::DrmSwapchain(DrmDevice* device, uint32_t width, uint32_t height,
-    uint32_t format, const QVector<uint64_t>& modifiers)
+    uint32_t format, const QVector<uint64_t>& modifiers, int depth)
+    : m_allocator(device->allocator())
 {
-    DrmAllocator* allocator = device->allocator();
-    for (int i = 0; i < 3; ++i)
-        m_images << allocator->allocate(width, height, format, modifiers);
+    QVector<uint64_t> candidates = modifiers;
+
+    for (int i = 0; i < depth; ++i) {
+        DrmImage* image = m_allocator->allocate(width, height, format, candidates);
+        if (!image)
+            continue;
+
+        // Stick to the layout that worked, so the allocator doesn't have to
+        // find it again and all images are laid out the same.
+        if (image->isValid() && !candidates.isEmpty()) {
+            const uint64_t modifier = image->buffer()->modifier();
+            if (modifier != DRM_FORMAT_MOD_INVALID)
+                candidates = { modifier };
+        }
+
+        image->m_swapchain = this;
+        m_images << image;
+        m_freeImages.enqueue(image);
+    }
 }
 
 DrmSwapchain::~DrmSwapchain()
 {
-    qDeleteAll(m_images);
+    for (DrmImage* image : m_images) {
+        image->m_swapchain = nullptr;
+        image->m_frame = 0;
+
+        // An image that is still in use, e.g. scanned out or waiting for a
+        // page flip, must not be handed out or destroyed by the allocator yet.
+        // It's recycled once its user releases it.
+        if (image->isBusy())
+            image->m_allocator = m_allocator;
+        else
+            m_allocator->recycle(image);
+    }
 }
 
 bool DrmSwapchain::isValid() const
 {
+    if (m_images.isEmpty())
+        return false;
+
     for (DrmImage* image : m_images) {
         if (!image->isValid())
             return false;
@@ -49,14 +83,54 @@ int DrmSwapchain::depth() const
     return m_images.count();
 }
 
+const DrmImageList& DrmSwapchain::images() const
+{
+    return m_images;
+}
+
 DrmImage* DrmSwapchain::acquire()
 {
-    for (DrmImage* image : m_images) {
-        if (image->isBusy())
-            continue;
-        image->setBusy(true);
-        return image;
+    if (m_freeImages.isEmpty())
+        return nullptr;
+
+    DrmImage* image = m_freeImages.dequeue();
+    image->setBusy(true);
+
+    return image;
+}
+
+void DrmSwapchain::acquire(std::function<void(DrmImage*)> callback)
+{
+    if (DrmImage* image = acquire()) {
+        callback(image);
+        return;
+    }
+
+    m_waiters.enqueue(callback);
+}
+
+void DrmSwapchain::markPresented(DrmImage* image)
+{
+    if (image->m_swapchain == this) {
+        image->m_frame = ++m_frameCounter;
+        return;
     }
 
-    return nullptr;
+    // A foreign image was scanned out directly, so none of our images hold
+    // the previous frame anymore and have to be repainted from scratch.
+    for (DrmImage* swapchainImage : m_images)
+        swapchainImage->m_frame = 0;
+}
+
+void DrmSwapchain::release(DrmImage* image)
+{
+    // Images are recycled in the order they were released, which keeps
+    // their age predictable for the renderer.
+    m_freeImages.enqueue(image);
+
+    if (m_waiters.isEmpty())
+        return;
+
+    const std::function<void(DrmImage*)> callback = m_waiters.dequeue();
+    callback(acquire());
 }
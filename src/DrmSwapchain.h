@@ -20,10 +20,20 @@
 
 #include "globals.h"
 
+#include <QQueue>
+#include <QVector>
+
+#include <functional>
+
 class DrmSwapchain {
 public:
     DrmSwapchain(DrmDevice* device, uint32_t width, uint32_t height,
-        uint32_t format, const QVector<uint64_t>& modifiers);
+        uint32_t format, const QVector<uint64_t>& modifiers, int depth = 3);
+
+    /**
+     * Destroys the swapchain. Images that haven't been released yet outlive
+     * it, they go back to the allocator once they are released.
+     */
     ~DrmSwapchain();
 
     /**
@@ -36,11 +46,43 @@ public:
      */
     int depth() const;
 
+    /**
+     * Returns all images in this swapchain.
+     */
+    const DrmImageList& images() const;
+
     /**
      * Acquires an image for rendering.
+     *
+     * If all images are busy, @c null is returned.
      */
     DrmImage* acquire();
 
+    /**
+     * Acquires an image for rendering.
+     *
+     * If there is a free image, the @p callback is invoked right away. Otherwise
+     * it's invoked as soon as an image is released, e.g. after a page flip. The
+     * callback is dropped if the swapchain is destroyed before that happens.
+     */
+    void acquire(std::function<void(DrmImage*)> callback);
+
+    /**
+     * Marks the given image as being presented.
+     *
+     * This is used to compute the age of images. Images that don't belong to
+     * this swapchain reset the age of all images.
+     */
+    void markPresented(DrmImage* image);
+
 private:
+    void release(DrmImage* image);
+
+    DrmAllocator* m_allocator;
     DrmImageList m_images;
+    QQueue<DrmImage*> m_freeImages;
+    QQueue<std::function<void(DrmImage*)>> m_waiters;
+    uint64_t m_frameCounter = 0;
+
+    friend class DrmImage;
 };
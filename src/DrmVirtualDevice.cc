@@ -0,0 +1,475 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DrmVirtualDevice.h"
+#include "DrmProperty.h"
+
+#include <QTimer>
+
+#include <drm_fourcc.h>
+#include <xf86drm.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+static std::chrono::nanoseconds currentTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+// libdrm has no way to read a request back, so its layout is mirrored here.
+// It hasn't changed since atomic modesetting was added, see xf86drmMode.c.
+struct AtomicRequestItem {
+    uint32_t objectId;
+    uint32_t propertyId;
+    uint64_t value;
+    uint32_t cursor;
+};
+
+struct AtomicRequest {
+    uint32_t cursor;
+    uint32_t itemCount;
+    AtomicRequestItem* items;
+};
+
+template <typename T>
+static T* allocate(size_t count = 1)
+{
+    // libdrm releases everything with free().
+    return static_cast<T*>(calloc(count, sizeof(T)));
+}
+
+template <typename T>
+static T* copyArray(const QVector<T>& data)
+{
+    T* array = allocate<T>(data.count());
+    std::copy(data.begin(), data.end(), array);
+    return array;
+}
+
+static drmModeModeInfo makeMode(const QSize& resolution, uint32_t refreshRate)
+{
+    drmModeModeInfo mode = {};
+
+    mode.hdisplay = resolution.width();
+    mode.hsync_start = mode.hdisplay + 48;
+    mode.hsync_end = mode.hsync_start + 32;
+    mode.htotal = mode.hsync_end + 80;
+
+    mode.vdisplay = resolution.height();
+    mode.vsync_start = mode.vdisplay + 3;
+    mode.vsync_end = mode.vsync_start + 5;
+    mode.vtotal = mode.vsync_end + 32;
+
+    mode.clock = uint64_t(mode.htotal) * mode.vtotal * refreshRate / 1000000;
+    mode.vrefresh = (refreshRate + 500) / 1000;
+    mode.type = DRM_MODE_TYPE_DRIVER | DRM_MODE_TYPE_PREFERRED;
+
+    snprintf(mode.name, sizeof(mode.name), "%dx%d", resolution.width(), resolution.height());
+
+    return mode;
+}
+
+static drm_mode_property_enum makeEnumerator(uint64_t value, const char* name)
+{
+    drm_mode_property_enum enumerator = {};
+    enumerator.value = value;
+    strncpy(enumerator.name, name, sizeof(enumerator.name) - 1);
+    return enumerator;
+}
+
+DrmVirtualDevice::DrmVirtualDevice(int outputCount, const QSize& resolution,
+    uint32_t refreshRate, QObject* parent)
+    : QObject(parent)
+    , m_mode(makeMode(resolution, refreshRate))
+    , m_epoch(currentTime())
+    , m_refreshInterval(1000000000000ll / qMax(refreshRate, 1u))
+{
+    m_connectorCrtcPropertyId = createProperty("CRTC_ID", DRM_MODE_PROP_OBJECT);
+
+    m_connectorProperties = {
+        m_connectorCrtcPropertyId,
+        createProperty("DPMS", DRM_MODE_PROP_ENUM),
+    };
+
+    m_crtcProperties = {
+        createProperty("ACTIVE", DRM_MODE_PROP_RANGE),
+        createProperty("MODE_ID", DRM_MODE_PROP_BLOB),
+    };
+
+    m_typePropertyId = createProperty("type", DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE, {
+        makeEnumerator(DRM_PLANE_TYPE_OVERLAY, "Overlay"),
+        makeEnumerator(DRM_PLANE_TYPE_PRIMARY, "Primary"),
+        makeEnumerator(DRM_PLANE_TYPE_CURSOR, "Cursor"),
+    });
+
+    m_planeProperties = {
+        m_typePropertyId,
+        createProperty("CRTC_ID", DRM_MODE_PROP_OBJECT),
+        createProperty("CRTC_X", DRM_MODE_PROP_SIGNED_RANGE),
+        createProperty("CRTC_Y", DRM_MODE_PROP_SIGNED_RANGE),
+        createProperty("CRTC_W", DRM_MODE_PROP_RANGE),
+        createProperty("CRTC_H", DRM_MODE_PROP_RANGE),
+        createProperty("FB_DAMAGE_CLIPS", DRM_MODE_PROP_BLOB),
+        createProperty("FB_ID", DRM_MODE_PROP_OBJECT),
+        createProperty("SRC_X", DRM_MODE_PROP_RANGE),
+        createProperty("SRC_Y", DRM_MODE_PROP_RANGE),
+        createProperty("SRC_W", DRM_MODE_PROP_RANGE),
+        createProperty("SRC_H", DRM_MODE_PROP_RANGE),
+    };
+
+    outputCount = qBound(0, outputCount, maxOutputCount);
+    for (int i = 0; i < outputCount; ++i) {
+        Output output;
+        output.connectorId = ++m_lastId;
+        output.encoderId = ++m_lastId;
+        output.crtcId = ++m_lastId;
+        output.primaryPlaneId = ++m_lastId;
+        output.cursorPlaneId = ++m_lastId;
+        output.vblankTimer = new QTimer(this);
+        output.vblankTimer->setSingleShot(true);
+        output.vblankTimer->setTimerType(Qt::PreciseTimer);
+        output.isFlipPending = false;
+
+        connect(output.vblankTimer, &QTimer::timeout, this, [this, i] { vblank(i); });
+
+        m_outputs << output;
+    }
+}
+
+DrmVirtualDevice::~DrmVirtualDevice()
+{
+    qDeleteAll(m_properties);
+}
+
+uint32_t DrmVirtualDevice::createProperty(const char* name, uint32_t flags,
+    const QVector<drm_mode_property_enum>& enums)
+{
+    auto property = new DrmProperty();
+    property->id = ++m_lastId;
+    property->flags = flags;
+    property->name = name;
+    property->enums = enums;
+
+    m_properties.insert(property->id, property);
+
+    return property->id;
+}
+
+int DrmVirtualDevice::findOutput(uint32_t id) const
+{
+    for (int i = 0; i < m_outputs.count(); ++i) {
+        const Output& output = m_outputs.at(i);
+        if (output.connectorId == id || output.encoderId == id || output.crtcId == id)
+            return i;
+        if (output.primaryPlaneId == id || output.cursorPlaneId == id)
+            return i;
+    }
+
+    return -1;
+}
+
+uint32_t DrmVirtualDevice::possibleCrtcs(int index) const
+{
+    // Like on real hardware, not every connector can be routed to every CRTC,
+    // so that the routing search has something to do.
+    const int nextIndex = (index + 1) % m_outputs.count();
+    return (1u << index) | (1u << nextIndex);
+}
+
+uint64_t DrmVirtualDevice::capability(uint64_t capability) const
+{
+    switch (capability) {
+    case DRM_CAP_CURSOR_WIDTH:
+    case DRM_CAP_CURSOR_HEIGHT:
+        return 64;
+    case DRM_CAP_TIMESTAMP_MONOTONIC:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+drmModeRes* DrmVirtualDevice::getResources() const
+{
+    QVector<uint32_t> connectors;
+    QVector<uint32_t> encoders;
+    QVector<uint32_t> crtcs;
+
+    for (const Output& output : m_outputs) {
+        connectors << output.connectorId;
+        encoders << output.encoderId;
+        crtcs << output.crtcId;
+    }
+
+    drmModeRes* resources = allocate<drmModeRes>();
+    resources->count_connectors = connectors.count();
+    resources->connectors = copyArray(connectors);
+    resources->count_encoders = encoders.count();
+    resources->encoders = copyArray(encoders);
+    resources->count_crtcs = crtcs.count();
+    resources->crtcs = copyArray(crtcs);
+    resources->max_width = 16384;
+    resources->max_height = 16384;
+
+    return resources;
+}
+
+drmModePlaneRes* DrmVirtualDevice::getPlaneResources() const
+{
+    QVector<uint32_t> planes;
+    for (const Output& output : m_outputs)
+        planes << output.primaryPlaneId << output.cursorPlaneId;
+
+    drmModePlaneRes* resources = allocate<drmModePlaneRes>();
+    resources->count_planes = planes.count();
+    resources->planes = copyArray(planes);
+
+    return resources;
+}
+
+drmModeConnector* DrmVirtualDevice::getConnector(uint32_t id) const
+{
+    const int index = findOutput(id);
+    if (index == -1 || m_outputs.at(index).connectorId != id)
+        return nullptr;
+
+    const Output& output = m_outputs.at(index);
+
+    drmModeConnector* connector = allocate<drmModeConnector>();
+    connector->connector_id = id;
+    connector->connector_type = DRM_MODE_CONNECTOR_VIRTUAL;
+    connector->connector_type_id = index + 1;
+    connector->connection = DRM_MODE_CONNECTED;
+    connector->count_modes = 1;
+    connector->modes = copyArray(QVector<drmModeModeInfo> { m_mode });
+    connector->count_encoders = 1;
+    connector->encoders = copyArray(QVector<uint32_t> { output.encoderId });
+
+    return connector;
+}
+
+drmModeEncoder* DrmVirtualDevice::getEncoder(uint32_t id) const
+{
+    const int index = findOutput(id);
+    if (index == -1 || m_outputs.at(index).encoderId != id)
+        return nullptr;
+
+    drmModeEncoder* encoder = allocate<drmModeEncoder>();
+    encoder->encoder_id = id;
+    encoder->encoder_type = DRM_MODE_ENCODER_VIRTUAL;
+    encoder->possible_crtcs = possibleCrtcs(index);
+
+    return encoder;
+}
+
+drmModeCrtc* DrmVirtualDevice::getCrtc(uint32_t id) const
+{
+    const int index = findOutput(id);
+    if (index == -1 || m_outputs.at(index).crtcId != id)
+        return nullptr;
+
+    // There is no firmware that could have lit up the outputs.
+    drmModeCrtc* crtc = allocate<drmModeCrtc>();
+    crtc->crtc_id = id;
+
+    return crtc;
+}
+
+drmModePlane* DrmVirtualDevice::getPlane(uint32_t id) const
+{
+    const int index = findOutput(id);
+    if (index == -1)
+        return nullptr;
+
+    const Output& output = m_outputs.at(index);
+    if (output.primaryPlaneId != id && output.cursorPlaneId != id)
+        return nullptr;
+
+    const QVector<uint32_t> formats = output.primaryPlaneId == id
+        ? QVector<uint32_t> { DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888 }
+        : QVector<uint32_t> { DRM_FORMAT_ARGB8888 };
+
+    drmModePlane* plane = allocate<drmModePlane>();
+    plane->plane_id = id;
+    plane->possible_crtcs = 1u << index;
+    plane->count_formats = formats.count();
+    plane->formats = copyArray(formats);
+
+    return plane;
+}
+
+drmModeObjectProperties* DrmVirtualDevice::getObjectProperties(uint32_t id, uint32_t type) const
+{
+    const int index = findOutput(id);
+    if (index == -1)
+        return nullptr;
+
+    const Output& output = m_outputs.at(index);
+
+    QVector<uint32_t> properties;
+    QVector<uint64_t> values;
+
+    switch (type) {
+    case DRM_MODE_OBJECT_CONNECTOR:
+        properties = m_connectorProperties;
+        break;
+    case DRM_MODE_OBJECT_CRTC:
+        properties = m_crtcProperties;
+        break;
+    case DRM_MODE_OBJECT_PLANE:
+        properties = m_planeProperties;
+        break;
+    default:
+        return nullptr;
+    }
+
+    for (uint32_t propertyId : properties) {
+        if (propertyId != m_typePropertyId)
+            values << 0;
+        else if (output.primaryPlaneId == id)
+            values << DRM_PLANE_TYPE_PRIMARY;
+        else
+            values << DRM_PLANE_TYPE_CURSOR;
+    }
+
+    drmModeObjectProperties* result = allocate<drmModeObjectProperties>();
+    result->count_props = properties.count();
+    result->props = copyArray(properties);
+    result->prop_values = copyArray(values);
+
+    return result;
+}
+
+const DrmProperty* DrmVirtualDevice::findProperty(uint32_t id) const
+{
+    return m_properties.value(id);
+}
+
+uint32_t DrmVirtualDevice::createPropertyBlob()
+{
+    return ++m_lastId;
+}
+
+uint32_t DrmVirtualDevice::addFramebuffer()
+{
+    return ++m_lastId;
+}
+
+bool DrmVirtualDevice::commit(uint32_t flags, const QVector<uint32_t>& crtcIds)
+{
+    if (flags & DRM_MODE_ATOMIC_TEST_ONLY)
+        return true;
+
+    QVector<int> indices;
+    for (uint32_t crtcId : crtcIds) {
+        const int index = findOutput(crtcId);
+        if (index == -1)
+            return false;
+
+        // Like the kernel, refuse to queue a second flip without blocking.
+        if (m_outputs.at(index).isFlipPending && (flags & DRM_MODE_ATOMIC_NONBLOCK))
+            return false;
+
+        indices << index;
+    }
+
+    if (!(flags & DRM_MODE_PAGE_FLIP_EVENT))
+        return true;
+
+    for (int index : indices) {
+        m_outputs[index].isFlipPending = true;
+        scheduleVblank(index);
+    }
+
+    return true;
+}
+
+bool DrmVirtualDevice::testRouting(const drmModeAtomicReq* request) const
+{
+    auto atomicRequest = reinterpret_cast<const AtomicRequest*>(request);
+
+    // A later value of a property replaces an earlier one, like in the kernel.
+    QHash<uint32_t, uint32_t> routing;
+    for (uint32_t i = 0; i < atomicRequest->cursor; ++i) {
+        const AtomicRequestItem& item = atomicRequest->items[i];
+        if (item.propertyId == m_connectorCrtcPropertyId)
+            routing.insert(item.objectId, uint32_t(item.value));
+    }
+
+    uint32_t takenCrtcs = 0;
+
+    for (auto it = routing.constBegin(); it != routing.constEnd(); ++it) {
+        // The connector is turned off.
+        if (!it.value())
+            continue;
+
+        const int connectorIndex = findOutput(it.key());
+        const int crtcIndex = findOutput(it.value());
+        if (connectorIndex == -1 || crtcIndex == -1)
+            return false;
+        if (m_outputs.at(connectorIndex).connectorId != it.key())
+            return false;
+        if (m_outputs.at(crtcIndex).crtcId != it.value())
+            return false;
+
+        const uint32_t crtcMask = 1u << crtcIndex;
+        if (!(possibleCrtcs(connectorIndex) & crtcMask) || (takenCrtcs & crtcMask))
+            return false;
+
+        takenCrtcs |= crtcMask;
+    }
+
+    return true;
+}
+
+void DrmVirtualDevice::scheduleVblank(int index)
+{
+    QTimer* timer = m_outputs.at(index).vblankTimer;
+    if (timer->isActive())
+        return;
+
+    const std::chrono::nanoseconds now = currentTime();
+    const auto frames = (now - m_epoch) / m_refreshInterval + 1;
+    const std::chrono::nanoseconds target = m_epoch + frames * m_refreshInterval;
+
+    const auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+        target - now + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1));
+    timer->start(int(delay.count()));
+}
+
+void DrmVirtualDevice::vblank(int index)
+{
+    Output& output = m_outputs[index];
+    if (!output.isFlipPending)
+        return;
+
+    // The timer is only precise to a millisecond, report the exact vblank.
+    const std::chrono::nanoseconds now = currentTime();
+    const auto sequence = (now - m_epoch) / m_refreshInterval;
+    const std::chrono::nanoseconds timestamp = m_epoch + sequence * m_refreshInterval;
+
+    output.isFlipPending = false;
+
+    emit pageFlipped(output.crtcId, uint(sequence), timestamp);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "globals.h"
+
+#include <QHash>
+#include <QObject>
+#include <QSize>
+#include <QVector>
+
+#include <xf86drmMode.h>
+
+#include <chrono>
+
+class QTimer;
+
+/**
+ * In-memory stand-in for the kernel side of a DRM device.
+ *
+ * Every output gets a connector, an encoder, a CRTC, a primary and a cursor
+ * plane. Each encoder can drive its own CRTC and the one of the next output.
+ * Commits succeed unless the routing is impossible, and page flips complete
+ * on simulated vblanks at the configured refresh rate. This allows to run and benchmark the whole
+ * stack on machines without a GPU, and with far more outputs than any real
+ * card has.
+ *
+ * The returned libdrm structures are allocated the same way libdrm does it,
+ * so they can be freed with the usual functions.
+ */
+class DrmVirtualDevice : public QObject {
+    Q_OBJECT
+
+public:
+    /**
+     * Creates a device with @p outputCount outputs. Since CRTCs are addressed
+     * with a 32 bit mask, at most 32 outputs are supported per device.
+     *
+     * The @p refreshRate is in millihertz.
+     */
+    DrmVirtualDevice(int outputCount, const QSize& resolution, uint32_t refreshRate,
+        QObject* parent = nullptr);
+    ~DrmVirtualDevice() override;
+
+    /**
+     * The maximum number of outputs of a single virtual device.
+     */
+    static const int maxOutputCount = 32;
+
+    uint64_t capability(uint64_t capability) const;
+    drmModeRes* getResources() const;
+    drmModePlaneRes* getPlaneResources() const;
+    drmModeConnector* getConnector(uint32_t id) const;
+    drmModeEncoder* getEncoder(uint32_t id) const;
+    drmModeCrtc* getCrtc(uint32_t id) const;
+    drmModePlane* getPlane(uint32_t id) const;
+    drmModeObjectProperties* getObjectProperties(uint32_t id, uint32_t type) const;
+    const DrmProperty* findProperty(uint32_t id) const;
+
+    uint32_t createPropertyBlob();
+    uint32_t addFramebuffer();
+
+    /**
+     * Pretends to apply a commit that touches the given @p crtcIds.
+     */
+    bool commit(uint32_t flags, const QVector<uint32_t>& crtcIds);
+
+    /**
+     * Pretends to test a modeset @p request that routes connectors to CRTCs.
+     * Like the kernel, it fails if a connector can't reach its CRTC, or if a
+     * CRTC is used by more than one connector.
+     */
+    bool testRouting(const drmModeAtomicReq* request) const;
+
+signals:
+    /**
+     * This signal is emitted when a page flip on the given CRTC has completed.
+     */
+    void pageFlipped(uint32_t crtcId, uint sequence, std::chrono::nanoseconds timestamp);
+
+private:
+    struct Output {
+        uint32_t connectorId;
+        uint32_t encoderId;
+        uint32_t crtcId;
+        uint32_t primaryPlaneId;
+        uint32_t cursorPlaneId;
+        QTimer* vblankTimer;
+        bool isFlipPending;
+    };
+
+    uint32_t createProperty(const char* name, uint32_t flags,
+        const QVector<drm_mode_property_enum>& enums = QVector<drm_mode_property_enum>());
+    int findOutput(uint32_t id) const;
+    uint32_t possibleCrtcs(int index) const;
+    void scheduleVblank(int index);
+    void vblank(int index);
+
+    QVector<Output> m_outputs;
+    QHash<uint32_t, DrmProperty*> m_properties;
+    QVector<uint32_t> m_connectorProperties;
+    QVector<uint32_t> m_crtcProperties;
+    QVector<uint32_t> m_planeProperties;
+    drmModeModeInfo m_mode;
+    std::chrono::nanoseconds m_epoch;
+    std::chrono::nanoseconds m_refreshInterval;
+    uint32_t m_typePropertyId = 0;
+    uint32_t m_connectorCrtcPropertyId = 0;
+    uint32_t m_lastId = 0;
+
+    Q_DISABLE_COPY(DrmVirtualDevice)
+};
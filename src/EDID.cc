@@ -231,6 +231,26 @@ static int parseManufactureYear(const uint8_t* data)
     return 1990 + data[17];
 }
 
+static void parseRefreshRateRange(const uint8_t* data, int* minimum, int* maximum)
+{
+    for (int i = 54; i <= 108; i += 18) {
+        // Skip the block if it isn't used as monitor descriptor.
+        if (data[i])
+            continue;
+        if (data[i + 1])
+            continue;
+
+        // We have found the display range limits. Rates above 255 Hz are
+        // stored with an offset.
+        if (data[i + 3] == 0xfd) {
+            const uint8_t offsets = data[i + 4] & 0x03;
+            *minimum = data[i + 5] + (offsets == 0x03 ? 255 : 0);
+            *maximum = data[i + 6] + (offsets & 0x02 ? 255 : 0);
+            return;
+        }
+    }
+}
+
 EDID::EDID(const void* data, uint32_t size)
 {
     const uint8_t* bytes = static_cast<const uint8_t*>(data);
@@ -247,6 +267,7 @@ EDID::EDID(const void* data, uint32_t size)
     m_serialNumber = parseSerialNumber(bytes);
     m_manufactureWeek = parseManufactureWeek(bytes);
     m_manufactureYear = parseManufactureYear(bytes);
+    parseRefreshRateRange(bytes, &m_minimumRefreshRate, &m_maximumRefreshRate);
     m_isValid = true;
 }
 
@@ -284,3 +305,13 @@ int EDID::manufactureYear() const
 {
     return m_manufactureYear;
 }
+
+int EDID::minimumRefreshRate() const
+{
+    return m_minimumRefreshRate;
+}
+
+int EDID::maximumRefreshRate() const
+{
+    return m_maximumRefreshRate;
+}
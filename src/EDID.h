@@ -62,6 +62,20 @@ public:
      */
     int manufactureYear() const;
 
+    /**
+     * Returns the lowest vertical refresh rate of the monitor, in Hz.
+     *
+     * If the monitor doesn't tell, 0 is returned.
+     */
+    int minimumRefreshRate() const;
+
+    /**
+     * Returns the highest vertical refresh rate of the monitor, in Hz.
+     *
+     * If the monitor doesn't tell, 0 is returned.
+     */
+    int maximumRefreshRate() const;
+
 private:
     QSize m_physicalSize;
     QByteArray m_monitorName;
@@ -69,5 +83,7 @@ private:
     QByteArray m_serialNumber;
     int m_manufactureWeek;
     int m_manufactureYear;
+    int m_minimumRefreshRate = 0;
+    int m_maximumRefreshRate = 0;
     bool m_isValid = false;
 };
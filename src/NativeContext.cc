@@ -17,47 +17,119 @@
  */
 
 #include "NativeContext.h"
+#include "DrmDevice.h"
 #include "DrmDeviceManager.h"
+#include "DrmFrameTimeline.h"
 #include "DrmOutputManager.h"
+#include "session/DirectSessionController.h"
 #include "session/LogindSessionController.h"
 #include "udev/UdevContext.h"
 
+#include <QTimer>
+
+#include <signal.h>
+
+static void blockTerminalSignals()
+{
+    // The direct session controller reads the VT switching signals from a
+    // signalfd, so no thread may handle them. A signal mask is per thread and
+    // inherited by new threads, so this has to happen before any is started,
+    // e.g. by D-Bus while trying logind.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+}
+
+static SessionController* createSessionController(QObject* parent)
+{
+    // DRM_PLAYGROUND_SESSION selects the session backend, either "logind"
+    // or "direct". Without it, logind is tried first, unless there are only
+    // virtual devices, which don't need a seat.
+    const QByteArray backend = qgetenv("DRM_PLAYGROUND_SESSION");
+    if (backend == QByteArrayLiteral("direct"))
+        return new DirectSessionController(parent);
+
+    if (backend.isEmpty() && qgetenv("DRM_PLAYGROUND_VIRTUAL_OUTPUTS").toInt() > 0)
+        return new DirectSessionController(parent);
+
+    auto sessionController = new LogindSessionController(parent);
+    if (sessionController->isValid() || backend == QByteArrayLiteral("logind"))
+        return sessionController;
+
+    delete sessionController;
+
+    return new DirectSessionController(parent);
+}
+
 NativeContext::NativeContext(QObject* parent)
     : QObject(parent)
 {
+    // Whatever happens, ready() is emitted once control returns to the event loop.
+    QTimer::singleShot(0, this, &NativeContext::setReady);
+
     m_udev = std::make_unique<UdevContext>();
     if (!m_udev->isValid())
         return;
 
-    m_sessionController = new LogindSessionController(this);
-    if (!m_sessionController->isValid())
-        return;
+    blockTerminalSignals();
 
-    m_deviceManager = new DrmDeviceManager(this);
-    if (!m_deviceManager->isValid())
+    m_sessionController = createSessionController(this);
+    if (!m_sessionController->isValid())
         return;
 
+    // Outputs are prepared as soon as devices find their connectors.
     m_outputManager = new DrmOutputManager(this);
     if (!m_outputManager->isValid())
         return;
+
+    m_deviceManager = new DrmDeviceManager(this);
+    if (!m_deviceManager->isReady())
+        connect(m_deviceManager, &DrmDeviceManager::ready, this, &NativeContext::setReady);
 }
 
 NativeContext::~NativeContext()
 {
+    // DRM_PLAYGROUND_TRACE names a file that receives the frame timings of all
+    // outputs as a Chrome trace on exit.
+    const QString traceFileName = QString::fromLocal8Bit(qgetenv("DRM_PLAYGROUND_TRACE"));
+    if (!traceFileName.isEmpty() && m_deviceManager) {
+        DrmOutputList outputs;
+        for (const DrmDevice* device : m_deviceManager->devices())
+            outputs << device->outputs();
+        DrmFrameTimeline::writeTrace(traceFileName, outputs);
+    }
+
     delete m_outputManager;
     delete m_deviceManager;
 }
 
+void NativeContext::setReady()
+{
+    // The devices may still be opening when control first gets back.
+    if (m_isReady || (m_deviceManager && !m_deviceManager->isReady()))
+        return;
+
+    m_isReady = true;
+    emit ready();
+}
+
+bool NativeContext::isReady() const
+{
+    return m_isReady;
+}
+
 bool NativeContext::isValid() const
 {
     if (!m_udev->isValid())
         return false;
     if (!m_sessionController->isValid())
         return false;
-    if (!m_deviceManager->isValid())
-        return false;
     if (!m_outputManager->isValid())
         return false;
+    if (!m_deviceManager->isValid())
+        return false;
     return true;
 }
 
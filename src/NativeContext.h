@@ -36,6 +36,14 @@ public:
     explicit NativeContext(QObject* parent = nullptr);
     ~NativeContext() override;
 
+    /**
+     * Whether this context has been set up, successfully or not.
+     *
+     * The devices are opened without blocking, so the context may become
+     * valid only after the constructor has returned.
+     */
+    bool isReady() const;
+
     /**
      * Whether this context is valid.
      */
@@ -66,12 +74,22 @@ public:
      */
     AllocatorType allocatorType() const;
 
+signals:
+    /**
+     * This signal is emitted from the event loop once the context has been set
+     * up, see isValid() for whether it was successful.
+     */
+    void ready();
+
 private:
+    void setReady();
+
     DrmDeviceManager* m_deviceManager = nullptr;
     DrmOutputManager* m_outputManager = nullptr;
     SessionController* m_sessionController = nullptr;
     std::unique_ptr<UdevContext> m_udev;
     AllocatorType m_allocatorType = AllocatorGbm;
+    bool m_isReady = false;
 
     Q_DISABLE_COPY(NativeContext)
 };
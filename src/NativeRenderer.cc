@@ -17,8 +17,19 @@
  */
 
 #include "NativeRenderer.h"
+#include "DrmBuffer.h"
 #include "DrmDevice.h"
+#include "DrmFrameTimeline.h"
+#include "DrmImage.h"
 #include "DrmOutput.h"
+#include "DrmSwapchain.h"
+
+#include <drm_fourcc.h>
+
+#include <algorithm>
+
+// Areas without contents are painted opaque black.
+static const uint32_t s_backgroundColor = 0xff000000;
 
 NativeRenderer::NativeRenderer(DrmDevice* device, QObject* parent)
     : QObject(parent)
@@ -35,16 +46,168 @@ bool NativeRenderer::isValid() const
     return true;
 }
 
-void NativeRenderer::beginFrame(DrmOutput* output)
+bool NativeRenderer::beginFrame(DrmOutput* output)
+{
+    DrmSwapchain* swapchain = output->swapchain();
+    if (!swapchain)
+        return false;
+
+    DrmImage* image = swapchain->acquire();
+    if (!image)
+        return false;
+
+    output->setPendingImage(image);
+    output->frameTimeline()->mark(DrmFrameStageAcquire);
+
+    return true;
+}
+
+static QRect outputRect(const DrmOutput* output)
+{
+    const DrmMode mode = output->desiredMode();
+    return QRect(0, 0, mode.width(), mode.height());
+}
+
+// As with DrmOutput::present(), an empty region stands for the whole output.
+static QRegion normalizeDamage(const DrmOutput* output, const QRegion& damaged)
+{
+    const QRect bounds = outputRect(output);
+    if (damaged.isEmpty())
+        return bounds;
+
+    return damaged & bounds;
+}
+
+QRegion NativeRenderer::repaintRegion(DrmOutput* output, const QRegion& damaged) const
+{
+    const QRect bounds = outputRect(output);
+
+    const DrmImage* image = output->pendingImage();
+    if (!image)
+        return bounds;
+
+    // The journal holds damage of the most recent frames, newest first.
+    const QList<QRegion> journal = m_damageJournal.value(output);
+
+    const int age = image->age();
+    if (!age || age - 1 > journal.count())
+        return bounds;
+
+    QRegion region = normalizeDamage(output, damaged);
+    for (int i = 0; i < age - 1; ++i)
+        region += journal.at(i);
+
+    return region & bounds;
+}
+
+static uint32_t* scanLine(const DrmImage* image, int y)
+{
+    auto bits = static_cast<uint8_t*>(image->data());
+    return reinterpret_cast<uint32_t*>(bits + y * image->stride());
+}
+
+static void fillRect(DrmImage* image, const QRect& rect, uint32_t color)
+{
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        uint32_t* row = scanLine(image, y);
+        std::fill(row + rect.left(), row + rect.right() + 1, color);
+    }
+}
+
+static bool isCompositable(const DrmImage* image)
+{
+    if (!image || !image->data())
+        return false;
+
+    switch (image->buffer()->format()) {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ARGB8888:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Blends a premultiplied ARGB pixel over an opaque one.
+static uint32_t blend(uint32_t source, uint32_t destination)
 {
-    Q_UNUSED(output)
-    // DrmImage* image = output->swapchain()->acquire();
-    // output->setPendingImage(image);
+    const uint32_t inverseAlpha = 255 - (source >> 24);
+
+    uint32_t result = 0xff000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+        const uint32_t s = (source >> shift) & 0xff;
+        const uint32_t d = (destination >> shift) & 0xff;
+        result |= qMin(s + (d * inverseAlpha + 127) / 255, 255u) << shift;
+    }
+
+    return result;
+}
+
+static void drawLayer(DrmImage* image, const DrmLayer& layer, const QRect& rect)
+{
+    const QRect& source = layer.sourceRect;
+    const QRect& target = layer.targetRect;
+    const bool isOpaque = layer.isOpaque || layer.image->buffer()->format() == DRM_FORMAT_XRGB8888;
+
+    // The source is sampled at the nearest pixel if the layer is scaled.
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const int sourceY = source.y() + (y - target.y()) * source.height() / target.height();
+        const uint32_t* sourceRow = scanLine(layer.image, sourceY);
+        uint32_t* row = scanLine(image, y);
+
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            const int sourceX = source.x() + (x - target.x()) * source.width() / target.width();
+            const uint32_t pixel = sourceRow[sourceX];
+            row[x] = isOpaque ? pixel | 0xff000000 : blend(pixel, row[x]);
+        }
+    }
+}
+
+void NativeRenderer::paint(DrmOutput* output, const DrmLayerList& layers, const QRegion& region)
+{
+    DrmImage* image = output->pendingImage();
+    if (!image || !image->data())
+        return;
+
+    const DrmBuffer* buffer = image->buffer();
+    if (buffer->format() != DRM_FORMAT_XRGB8888)
+        return;
+
+    const QRect bounds(0, 0, buffer->width(), buffer->height());
+    const QRegion clipped = region & bounds;
+
+    for (const QRect& rect : clipped)
+        fillRect(image, rect, s_backgroundColor);
+
+    for (const DrmLayer& layer : layers) {
+        if (!isCompositable(layer.image) || layer.sourceRect.isEmpty())
+            continue;
+
+        const DrmBuffer* layerBuffer = layer.image->buffer();
+        const QRect layerBounds(0, 0, layerBuffer->width(), layerBuffer->height());
+        if (!layerBounds.contains(layer.sourceRect))
+            continue;
+
+        for (const QRect& rect : clipped & layer.targetRect)
+            drawLayer(image, layer, rect);
+    }
 }
 
 void NativeRenderer::finishFrame(DrmOutput* output, const QRegion& damaged)
 {
-    Q_UNUSED(output)
-    Q_UNUSED(damaged)
-    // output->present();
+    const QRegion damage = normalizeDamage(output, damaged);
+
+    if (!m_damageJournal.contains(output)) {
+        connect(output, &QObject::destroyed, this, [this, output] {
+            m_damageJournal.remove(output);
+        });
+    }
+
+    QList<QRegion>& journal = m_damageJournal[output];
+    journal.prepend(damage);
+    while (journal.count() > output->swapchainDepth())
+        journal.removeLast();
+
+    output->frameTimeline()->mark(DrmFrameStageRenderEnd);
+    output->present(damage);
 }
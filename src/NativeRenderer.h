@@ -20,7 +20,11 @@
 
 #include "globals.h"
 
+#include "DrmLayer.h"
+
+#include <QHash>
 #include <QObject>
+#include <QRegion>
 
 class NativeRenderer : public QObject {
     Q_OBJECT
@@ -36,16 +40,41 @@ public:
 
     /**
      * Marks the beginning of rendering of a frame.
+     *
+     * If there is no image to render into, @c false is returned.
+     */
+    bool beginFrame(DrmOutput* output);
+
+    /**
+     * Returns the region of the pending image that has to be repainted.
+     *
+     * The contents of an image are only as old as its age, so besides the
+     * @p damaged region of the current frame, the damage of the frames that
+     * the image has missed has to be repainted too. An empty @p damaged
+     * region means that the whole output has changed.
+     */
+    QRegion repaintRegion(DrmOutput* output, const QRegion& damaged) const;
+
+    /**
+     * Composites the @p layers, ordered from bottom to top, into the given
+     * @p region of the pending image. The region is usually the one returned
+     * by repaintRegion(), the rest of the image is left as it is.
+     *
+     * Only images that the CPU can access are painted and composited.
      */
-    void beginFrame(DrmOutput* output);
+    void paint(DrmOutput* output, const DrmLayerList& layers, const QRegion& region);
 
     /**
-     * Finalizes the rendering of the frame.
+     * Finalizes the rendering of the frame and presents the pending image.
+     *
+     * The @p damaged region is the same as passed to repaintRegion(), it's
+     * remembered so the repaint region of later frames can be computed.
      */
     void finishFrame(DrmOutput* output, const QRegion& damaged);
 
 private:
     DrmDevice* m_device;
+    QHash<DrmOutput*, QList<QRegion>> m_damageJournal;
 
     Q_DISABLE_COPY(NativeRenderer)
 };
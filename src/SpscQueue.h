@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Bounded queue with a single producer and a single consumer.
+ *
+ * Neither side ever blocks or takes a lock, so it can be used to hand data
+ * between threads with tight deadlines. The @p Capacity must be a power of two.
+ */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity && !(Capacity & (Capacity - 1)), "Capacity must be a power of two");
+
+public:
+    SpscQueue()
+        : m_head(0)
+        , m_tail(0)
+    {
+    }
+
+    /**
+     * Appends the @p value to the queue. Must be called only by the producer.
+     *
+     * If the queue is full, @c false is returned.
+     */
+    bool push(const T& value)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        m_items[tail & (Capacity - 1)] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /**
+     * Takes the oldest value off the queue. Must be called only by the consumer.
+     *
+     * If the queue is empty, @c false is returned.
+     */
+    bool pop(T* value)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+
+        *value = m_items[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+private:
+    std::array<T, Capacity> m_items;
+
+    // Keep the indices on separate cache lines, each is written by one side.
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+};
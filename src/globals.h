@@ -18,31 +18,37 @@
 
 #pragma once
 
-#include <QList>
-#include <QMap>
+#include <QHash>
 #include <QSet>
+#include <QVector>
 
 class DrmAllocator;
 class DrmBlob;
 class DrmBuffer;
 class DrmConnector;
 class DrmCrtc;
+class DrmCursor;
 class DrmDevice;
+class DrmFrameScheduler;
+class DrmFrameTimeline;
 class DrmImage;
 class DrmMode;
 class DrmOutput;
 class DrmPlane;
+class DrmPlaneAssigner;
+struct DrmProperty;
 class DrmSwapchain;
+class DrmVirtualDevice;
 
-typedef QList<DrmConnector*> DrmConnectorList;
-typedef QList<DrmCrtc*> DrmCrtcList;
-typedef QList<DrmDevice*> DrmDeviceList;
-typedef QList<DrmImage*> DrmImageList;
-typedef QList<DrmMode> DrmModeList;
-typedef QList<DrmOutput*> DrmOutputList;
-typedef QList<DrmPlane*> DrmPlaneList;
+typedef QVector<DrmConnector*> DrmConnectorList;
+typedef QVector<DrmCrtc*> DrmCrtcList;
+typedef QVector<DrmDevice*> DrmDeviceList;
+typedef QVector<DrmImage*> DrmImageList;
+typedef QVector<DrmMode> DrmModeList;
+typedef QVector<DrmOutput*> DrmOutputList;
+typedef QVector<DrmPlane*> DrmPlaneList;
 
-typedef QMap<DrmConnector*, DrmCrtc*> DrmCrtcMap;
+typedef QHash<DrmConnector*, DrmCrtc*> DrmCrtcMap;
 
 typedef QSet<DrmConnector*> DrmConnectorSet;
 
@@ -63,3 +69,9 @@ enum PlaneType {
     PlaneOverlay,
     PlaneCursor,
 };
+
+enum VrrPolicy {
+    VrrPolicyNever,
+    VrrPolicyAlways,
+    VrrPolicyAutomatic
+};
@@ -38,11 +38,15 @@ int main(int argc, char** argv)
     QCoreApplication app(argc, argv);
 
     DrmBackend backend;
-    if (!backend.isValid())
-        return -1;
-
-    // Exit after 5 seconds.
-    QTimer::singleShot(5000, [] { QCoreApplication::exit(); });
+    QObject::connect(&backend, &DrmBackend::ready, [&backend] {
+        if (!backend.isValid()) {
+            QCoreApplication::exit(-1);
+            return;
+        }
+
+        // Exit after 5 seconds.
+        QTimer::singleShot(5000, [] { QCoreApplication::exit(); });
+    });
 
     return app.exec();
 }
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "DirectSessionController.h"
+
+#include <QSocketNotifier>
+
+#include <xf86drm.h>
+
+#include <fcntl.h>
+#include <linux/kd.h>
+#include <linux/vt.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int openTerminal(uint* number)
+{
+    // The controlling terminal is the one we were started on, if any.
+    const int fd = open("/dev/tty", O_RDWR | O_CLOEXEC | O_NOCTTY);
+    if (fd == -1)
+        return -1;
+
+    vt_stat state;
+    if (ioctl(fd, VT_GETSTATE, &state) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    *number = state.v_active;
+
+    return fd;
+}
+
+static dev_t deviceNumber(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return 0;
+
+    return st.st_rdev;
+}
+
+DirectSessionController::DirectSessionController(QObject* parent)
+    : SessionController(parent)
+{
+    m_terminalFd = openTerminal(&m_terminal);
+    if (m_terminalFd == -1)
+        return;
+
+    if (!setupTerminal()) {
+        close(m_terminalFd);
+        m_terminalFd = -1;
+        m_terminal = 0;
+    }
+}
+
+DirectSessionController::~DirectSessionController()
+{
+    if (m_terminalFd != -1) {
+        restoreTerminal();
+        close(m_terminalFd);
+    }
+
+    if (m_signalFd != -1)
+        close(m_signalFd);
+}
+
+bool DirectSessionController::isActive() const
+{
+    return m_isActive;
+}
+
+bool DirectSessionController::isValid() const
+{
+    return true;
+}
+
+QString DirectSessionController::seat() const
+{
+    // Devices that aren't tagged with a seat belong to seat0.
+    return QStringLiteral("seat0");
+}
+
+QString DirectSessionController::session() const
+{
+    return QString();
+}
+
+uint DirectSessionController::terminal() const
+{
+    return m_terminal;
+}
+
+int DirectSessionController::openRestricted(const QString& path)
+{
+    const int fd = open(path.toUtf8(), O_RDWR | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    m_fds << fd;
+
+    return fd;
+}
+
+void DirectSessionController::closeRestricted(int fd)
+{
+    m_fds.removeOne(fd);
+    close(fd);
+}
+
+void DirectSessionController::switchTo(int terminal)
+{
+    if (m_terminalFd == -1)
+        return;
+
+    ioctl(m_terminalFd, VT_ACTIVATE, terminal);
+}
+
+bool DirectSessionController::setupTerminal()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+
+    // The signals are delivered through the event loop rather than handlers.
+    // This only masks the calling thread, other threads must have inherited
+    // the mask, see NativeContext.
+    sigset_t previousMask;
+    if (pthread_sigmask(SIG_BLOCK, &mask, &previousMask))
+        return false;
+
+    m_signalFd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (m_signalFd == -1) {
+        pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+        return false;
+    }
+
+    vt_mode mode = {};
+    mode.mode = VT_PROCESS;
+    mode.relsig = SIGUSR1;
+    mode.acqsig = SIGUSR2;
+    if (ioctl(m_terminalFd, VT_SETMODE, &mode) < 0) {
+        close(m_signalFd);
+        m_signalFd = -1;
+        pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+        return false;
+    }
+
+    // Keep the kernel console from drawing over us.
+    ioctl(m_terminalFd, KDSETMODE, KD_GRAPHICS);
+
+    m_signalNotifier = new QSocketNotifier(m_signalFd, QSocketNotifier::Read, this);
+    connect(m_signalNotifier, &QSocketNotifier::activated, this, &DirectSessionController::handleSignal);
+
+    return true;
+}
+
+void DirectSessionController::restoreTerminal()
+{
+    vt_mode mode = {};
+    mode.mode = VT_AUTO;
+    ioctl(m_terminalFd, VT_SETMODE, &mode);
+    ioctl(m_terminalFd, KDSETMODE, KD_TEXT);
+}
+
+void DirectSessionController::handleSignal()
+{
+    signalfd_siginfo info;
+    while (read(m_signalFd, &info, sizeof(info)) == sizeof(info)) {
+        switch (info.ssi_signo) {
+        case SIGUSR1:
+            deactivate();
+            break;
+        case SIGUSR2:
+            activate();
+            break;
+        }
+    }
+}
+
+void DirectSessionController::deactivate()
+{
+    for (int fd : m_fds) {
+        emit devicePaused(deviceNumber(fd));
+        drmDropMaster(fd);
+    }
+
+    ioctl(m_terminalFd, VT_RELDISP, 1);
+
+    m_isActive = false;
+    emit activeChanged();
+}
+
+void DirectSessionController::activate()
+{
+    ioctl(m_terminalFd, VT_RELDISP, VT_ACKACQ);
+
+    for (int fd : m_fds) {
+        drmSetMaster(fd);
+        emit deviceResumed(deviceNumber(fd));
+    }
+
+    m_isActive = true;
+    emit activeChanged();
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2019 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include "SessionController.h"
+
+#include <QVector>
+
+class QSocketNotifier;
+
+/**
+ * Session controller that opens devices directly, without systemd-logind.
+ *
+ * The process has to be allowed to open the devices on its own. If it runs
+ * on a virtual terminal, switching away is handled with VT signals; without
+ * a terminal the session is always active.
+ */
+class DirectSessionController : public SessionController {
+    Q_OBJECT
+
+public:
+    explicit DirectSessionController(QObject* parent = nullptr);
+    ~DirectSessionController() override;
+
+    bool isActive() const override;
+    bool isValid() const override;
+
+    QString seat() const override;
+    QString session() const override;
+    uint terminal() const override;
+
+    int openRestricted(const QString& path) override;
+    void closeRestricted(int fd) override;
+
+    void switchTo(int terminal) override;
+
+private slots:
+    void handleSignal();
+
+private:
+    bool setupTerminal();
+    void restoreTerminal();
+    void deactivate();
+    void activate();
+
+    QSocketNotifier* m_signalNotifier = nullptr;
+    QVector<int> m_fds;
+    int m_terminalFd = -1;
+    int m_signalFd = -1;
+    uint m_terminal = 0;
+    bool m_isActive = true;
+
+    Q_DISABLE_COPY(DirectSessionController)
+};
@@ -25,6 +25,8 @@
 #include <QDBusMessage>
 #include <QDBusMetaType>
 #include <QDBusPendingCall>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
 #include <QDBusUnixFileDescriptor>
 #include <QVector>
 
@@ -79,6 +81,16 @@ const QDBusArgument& operator>>(const QDBusArgument& argument, LogindSessionList
     return argument;
 }
 
+static QDBusConnection connectToLogind()
+{
+    // Allows to run against a mock logind on a private bus.
+    const QString address = QString::fromLocal8Bit(qgetenv("DRM_PLAYGROUND_LOGIND_BUS"));
+    if (address.isEmpty())
+        return QDBusConnection::systemBus();
+
+    return QDBusConnection::connectToBus(address, QStringLiteral("logind"));
+}
+
 const static QVector<QString> s_graphicalSessionTypes {
     QStringLiteral("wayland"),
     QStringLiteral("x11"),
@@ -90,7 +102,7 @@ const static QVector<QString> s_graphicalSessionStates {
     QStringLiteral("online")
 };
 
-static QString findProcessSessionPath()
+static QString findProcessSessionPath(const QDBusConnection& bus)
 {
     QDBusMessage message = QDBusMessage::createMethodCall(
         QStringLiteral("org.freedesktop.login1"),
@@ -99,20 +111,20 @@ static QString findProcessSessionPath()
         QStringLiteral("GetSessionByPID"));
     message.setArguments({ uint32_t(QCoreApplication::applicationPid()) });
 
-    const QDBusMessage reply = QDBusConnection::systemBus().call(message);
+    const QDBusMessage reply = bus.call(message);
     if (reply.type() == QDBusMessage::ErrorMessage)
         return QString();
 
     return reply.arguments().first().value<QDBusObjectPath>().path();
 }
 
-static bool isGraphicalSession(const QString& session)
+static bool isGraphicalSession(const QDBusConnection& bus, const QString& session)
 {
     const QDBusInterface interface(
         QStringLiteral("org.freedesktop.login1"),
         session,
         QStringLiteral("org.freedesktop.login1.Session"),
-        QDBusConnection::systemBus());
+        bus);
 
     if (!interface.isValid())
         return false;
@@ -139,7 +151,7 @@ static T unbox(const QDBusMessage& message)
     return qdbus_cast<T>(box.variant().value<QDBusArgument>());
 }
 
-static QString findDisplaySessionPath()
+static QString findDisplaySessionPath(const QDBusConnection& bus)
 {
     QDBusMessage message = QDBusMessage::createMethodCall(
         QStringLiteral("org.freedesktop.login1"),
@@ -149,7 +161,7 @@ static QString findDisplaySessionPath()
     message.setArguments({ QStringLiteral("org.freedesktop.login1.User"),
         QStringLiteral("Display") });
 
-    const QDBusMessage reply = QDBusConnection::systemBus().call(message);
+    const QDBusMessage reply = bus.call(message);
     if (reply.type() == QDBusMessage::ErrorMessage)
         return QString();
 
@@ -158,7 +170,7 @@ static QString findDisplaySessionPath()
     return session.path.path();
 }
 
-static QString findGreeterSessionPath()
+static QString findGreeterSessionPath(const QDBusConnection& bus)
 {
     QDBusMessage message = QDBusMessage::createMethodCall(
         QStringLiteral("org.freedesktop.login1"),
@@ -168,7 +180,7 @@ static QString findGreeterSessionPath()
     message.setArguments({ QStringLiteral("org.freedesktop.login1.User"),
         QStringLiteral("Sessions") });
 
-    const QDBusMessage reply = QDBusConnection::systemBus().call(message);
+    const QDBusMessage reply = bus.call(message);
     if (reply.type() == QDBusMessage::ErrorMessage)
         return QString();
 
@@ -180,7 +192,7 @@ static QString findGreeterSessionPath()
             QStringLiteral("org.freedesktop.login1"),
             sessionPath,
             QStringLiteral("org.freedesktop.login1.Session"),
-            QDBusConnection::systemBus());
+            bus);
         if (!sessionInterface.isValid())
             continue;
 
@@ -194,18 +206,18 @@ static QString findGreeterSessionPath()
     return QString();
 }
 
-static QString findSessionPath()
+static QString findSessionPath(const QDBusConnection& bus)
 {
-    QString sessionPath = findProcessSessionPath();
+    QString sessionPath = findProcessSessionPath(bus);
     if (!sessionPath.isEmpty())
         return sessionPath;
 
-    sessionPath = findDisplaySessionPath();
-    if (!sessionPath.isEmpty() && isGraphicalSession(sessionPath))
+    sessionPath = findDisplaySessionPath(bus);
+    if (!sessionPath.isEmpty() && isGraphicalSession(bus, sessionPath))
         return sessionPath;
 
-    sessionPath = findGreeterSessionPath();
-    if (!sessionPath.isEmpty() && isGraphicalSession(sessionPath))
+    sessionPath = findGreeterSessionPath(bus);
+    if (!sessionPath.isEmpty() && isGraphicalSession(bus, sessionPath))
         return sessionPath;
 
     return QString();
@@ -213,10 +225,11 @@ static QString findSessionPath()
 
 LogindSessionController::LogindSessionController(QObject* parent)
     : SessionController(parent)
+    , m_bus(connectToLogind())
 {
     qDBusRegisterMetaType<LogindSession>();
 
-    m_sessionPath = findSessionPath();
+    m_sessionPath = findSessionPath(m_bus);
     if (m_sessionPath.isEmpty())
         return;
 
@@ -224,7 +237,7 @@ LogindSessionController::LogindSessionController(QObject* parent)
         QStringLiteral("org.freedesktop.login1"),
         QStringLiteral("/org/freedesktop/login1/seat/self"),
         QStringLiteral("org.freedesktop.login1.Seat"),
-        QDBusConnection::systemBus());
+        m_bus);
     if (!seatInterface.isValid())
         return;
 
@@ -234,7 +247,7 @@ LogindSessionController::LogindSessionController(QObject* parent)
         QStringLiteral("org.freedesktop.login1"),
         m_sessionPath,
         QStringLiteral("org.freedesktop.login1.Session"),
-        QDBusConnection::systemBus());
+        m_bus);
     if (!sessionInterface.isValid())
         return;
 
@@ -248,7 +261,7 @@ LogindSessionController::LogindSessionController(QObject* parent)
     if (!takeControl())
         return;
 
-    QDBusConnection::systemBus().connect(
+    m_bus.connect(
         QStringLiteral("org.freedesktop.login1"),
         m_sessionPath,
         QStringLiteral("org.freedesktop.login1.Session"),
@@ -256,7 +269,15 @@ LogindSessionController::LogindSessionController(QObject* parent)
         this,
         SLOT(slotPauseDevice(uint, uint, QString)));
 
-    QDBusConnection::systemBus().connect(
+    m_bus.connect(
+        QStringLiteral("org.freedesktop.login1"),
+        m_sessionPath,
+        QStringLiteral("org.freedesktop.login1.Session"),
+        QStringLiteral("ResumeDevice"),
+        this,
+        SLOT(slotResumeDevice(uint, uint, QDBusUnixFileDescriptor)));
+
+    m_bus.connect(
         QStringLiteral("org.freedesktop.login1"),
         m_sessionPath,
         QStringLiteral("org.freedesktop.DBus.Properties"),
@@ -298,20 +319,8 @@ uint LogindSessionController::terminal() const
     return m_terminal;
 }
 
-int LogindSessionController::openRestricted(const QString& path)
+static int takeDescriptor(const QDBusMessage& reply)
 {
-    struct stat st;
-    if (stat(path.toUtf8(), &st) < 0)
-        return -1;
-
-    QDBusMessage message = QDBusMessage::createMethodCall(
-        QStringLiteral("org.freedesktop.login1"),
-        m_sessionPath,
-        QStringLiteral("org.freedesktop.login1.Session"),
-        QStringLiteral("TakeDevice"));
-    message.setArguments({ major(st.st_rdev), minor(st.st_rdev) });
-
-    const QDBusMessage reply = QDBusConnection::systemBus().call(message);
     if (reply.type() == QDBusMessage::ErrorMessage)
         return -1;
 
@@ -323,6 +332,36 @@ int LogindSessionController::openRestricted(const QString& path)
     return fcntl(descriptor.fileDescriptor(), F_DUPFD_CLOEXEC, 0);
 }
 
+int LogindSessionController::openRestricted(const QString& path)
+{
+    struct stat st;
+    if (stat(path.toUtf8(), &st) < 0)
+        return -1;
+
+    const QDBusMessage message = takeDeviceMessage(st.st_rdev);
+    const QDBusMessage reply = m_bus.call(message);
+
+    return takeDescriptor(reply);
+}
+
+void LogindSessionController::openRestrictedAsync(const QString& path, std::function<void(int)> callback)
+{
+    struct stat st;
+    if (stat(path.toUtf8(), &st) < 0) {
+        callback(-1);
+        return;
+    }
+
+    const QDBusMessage message = takeDeviceMessage(st.st_rdev);
+    const QDBusPendingCall call = m_bus.asyncCall(message);
+
+    auto watcher = new QDBusPendingCallWatcher(call, this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [callback](QDBusPendingCallWatcher* watcher) {
+        watcher->deleteLater();
+        callback(takeDescriptor(watcher->reply()));
+    });
+}
+
 void LogindSessionController::closeRestricted(int fd)
 {
     struct stat st;
@@ -334,13 +373,25 @@ void LogindSessionController::closeRestricted(int fd)
         m_sessionPath,
         QStringLiteral("org.freedesktop.login1.Session"),
         QStringLiteral("ReleaseDevice"));
-    message.setArguments({ major(st.st_dev), minor(st.st_dev) });
+    message.setArguments({ major(st.st_rdev), minor(st.st_rdev) });
 
-    QDBusConnection::systemBus().asyncCall(message);
+    m_bus.asyncCall(message);
 
     close(fd);
 }
 
+QDBusMessage LogindSessionController::takeDeviceMessage(dev_t device) const
+{
+    QDBusMessage message = QDBusMessage::createMethodCall(
+        QStringLiteral("org.freedesktop.login1"),
+        m_sessionPath,
+        QStringLiteral("org.freedesktop.login1.Session"),
+        QStringLiteral("TakeDevice"));
+    message.setArguments({ major(device), minor(device) });
+
+    return message;
+}
+
 void LogindSessionController::switchTo(int terminal)
 {
     QDBusMessage message = QDBusMessage::createMethodCall(
@@ -350,7 +401,7 @@ void LogindSessionController::switchTo(int terminal)
         QStringLiteral("SwitchTo"));
     message.setArguments({ terminal });
 
-    QDBusConnection::systemBus().asyncCall(message);
+    m_bus.asyncCall(message);
 }
 
 bool LogindSessionController::takeControl()
@@ -362,7 +413,7 @@ bool LogindSessionController::takeControl()
         QStringLiteral("TakeControl"));
     message.setArguments({ false });
 
-    const QDBusMessage reply = QDBusConnection::systemBus().call(message);
+    const QDBusMessage reply = m_bus.call(message);
 
     return reply.type() != QDBusMessage::ErrorMessage;
 }
@@ -375,7 +426,7 @@ void LogindSessionController::releaseControl()
         QStringLiteral("org.freedesktop.login1.Session"),
         QStringLiteral("ReleaseControl"));
 
-    QDBusConnection::systemBus().asyncCall(message);
+    m_bus.asyncCall(message);
 }
 
 bool LogindSessionController::activate()
@@ -386,13 +437,19 @@ bool LogindSessionController::activate()
         QStringLiteral("org.freedesktop.login1.Session"),
         QStringLiteral("Activate"));
 
-    const QDBusMessage reply = QDBusConnection::systemBus().call(message);
+    const QDBusMessage reply = m_bus.call(message);
 
     return reply.type() != QDBusMessage::ErrorMessage;
 }
 
 void LogindSessionController::slotPauseDevice(uint major, uint minor, const QString& type)
 {
+    // The device is about to be unplugged, udev will tell us about it.
+    if (type == QLatin1String("gone"))
+        return;
+
+    emit devicePaused(makedev(major, minor));
+
     if (type == QLatin1String("pause")) {
         QDBusMessage message = QDBusMessage::createMethodCall(
             QStringLiteral("org.freedesktop.login1"),
@@ -401,10 +458,19 @@ void LogindSessionController::slotPauseDevice(uint major, uint minor, const QStr
             QStringLiteral("PauseDeviceComplete"));
         message.setArguments({ major, minor });
 
-        QDBusConnection::systemBus().asyncCall(message);
+        m_bus.asyncCall(message);
     }
 }
 
+void LogindSessionController::slotResumeDevice(uint major, uint minor, const QDBusUnixFileDescriptor& descriptor)
+{
+    // DRM devices keep their file descriptors across pauses, logind only
+    // restores the master status.
+    Q_UNUSED(descriptor)
+
+    emit deviceResumed(makedev(major, minor));
+}
+
 void LogindSessionController::slotPropertiesChanged(const QString& interfaceName, const QVariantMap& properties)
 {
     if (interfaceName != QLatin1String("org.freedesktop.login1.Session"))
@@ -417,7 +483,7 @@ void LogindSessionController::slotPropertiesChanged(const QString& interfaceName
         QStringLiteral("org.freedesktop.login1"),
         m_sessionPath,
         QStringLiteral("org.freedesktop.login1.Session"),
-        QDBusConnection::systemBus());
+        m_bus);
     if (!sessionInterface.isValid())
         return;
 
@@ -20,6 +20,9 @@
 
 #include "SessionController.h"
 
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusUnixFileDescriptor>
 #include <QVariantMap>
 
 class LogindSessionController : public SessionController {
@@ -38,18 +41,22 @@ public:
 
     int openRestricted(const QString& path) override;
     void closeRestricted(int fd) override;
+    void openRestrictedAsync(const QString& path, std::function<void(int)> callback) override;
 
     void switchTo(int terminal) override;
 
 private slots:
     void slotPauseDevice(uint major, uint minor, const QString& type);
+    void slotResumeDevice(uint major, uint minor, const QDBusUnixFileDescriptor& descriptor);
     void slotPropertiesChanged(const QString& interfaceName, const QVariantMap& properties);
 
 private:
     bool takeControl();
     void releaseControl();
     bool activate();
+    QDBusMessage takeDeviceMessage(dev_t device) const;
 
+    QDBusConnection m_bus;
     QString m_seat;
     uint m_terminal = 0;
     QString m_sessionId;
@@ -22,3 +22,8 @@ SessionController::SessionController(QObject* parent)
     : QObject(parent)
 {
 }
+
+void SessionController::openRestrictedAsync(const QString& path, std::function<void(int)> callback)
+{
+    callback(openRestricted(path));
+}
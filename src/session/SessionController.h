@@ -20,6 +20,10 @@
 
 #include <QObject>
 
+#include <functional>
+
+#include <sys/types.h>
+
 class SessionController : public QObject {
     Q_OBJECT
 
@@ -36,11 +40,29 @@ public:
     virtual int openRestricted(const QString& path) = 0;
     virtual void closeRestricted(int fd) = 0;
 
+    /**
+     * Opens the device at the given @p path without blocking the caller.
+     *
+     * The @p callback is invoked with the file descriptor of the device, or -1
+     * if it couldn't be opened. Several devices can be opened at once.
+     */
+    virtual void openRestrictedAsync(const QString& path, std::function<void(int)> callback);
+
     virtual void switchTo(int terminal) = 0;
 
 signals:
     void activeChanged();
 
+    /**
+     * This signal is emitted when access to the given device has been revoked.
+     */
+    void devicePaused(dev_t device);
+
+    /**
+     * This signal is emitted when access to the given device has been restored.
+     */
+    void deviceResumed(dev_t device);
+
 private:
     Q_DISABLE_COPY(SessionController)
 };